@@ -14,8 +14,406 @@
 #include "agent.h"
 #include "episode.h"
 #include "statistic.h"
+#include "search.h"
+#include "profile.h"
+#include "ring.h"
 #include <stdio.h>
 #include<vector>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <cmath>
+#include <iomanip>
+
+/**
+ * global heap allocation counter, reported by --count-allocs
+ */
+static std::atomic<size_t> allocs(0);
+__attribute__((noinline)) void* operator new(size_t size) {
+	allocs.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+
+/**
+ * the value of 'key' in agent arguments such as "name=xxx seed=1", or 'fallback' if absent
+ */
+std::string argument(const std::string& args, const std::string& key, const std::string& fallback = "") {
+	std::string value = fallback;
+	std::stringstream ss(args);
+	for (std::string pair; ss >> pair; ) {
+		if (pair.substr(0, pair.find('=')) == key) value = pair.substr(pair.find('=') + 1);
+	}
+	return value;
+}
+/**
+ * agent arguments such as "name=xxx seed=1" without the pairs of 'key'
+ */
+std::string without(const std::string& args, const std::string& key) {
+	std::string rest;
+	std::stringstream ss(args);
+	for (std::string pair; ss >> pair; ) {
+		if (pair.substr(0, pair.find('=')) != key) rest += (rest.size() ? " " : "") + pair;
+	}
+	return rest;
+}
+
+/**
+ * create the player from its arguments, e.g., "search=expectimax depth=3" selects the search player
+ * with 'master', the player shares the weight tables of 'master'
+ */
+weight_agent* make_player(const std::string& args, const weight_agent* master = nullptr) {
+	std::string search = argument(args, "search");
+	if (search == "expectimax") {
+		return master ? new expectimax_agent(*master, args) : new expectimax_agent(args);
+	} else if (search.size()) {
+		std::cerr << "unknown search: " << search << std::endl;
+		std::exit(1);
+	}
+	return master ? new weight_agent(*master, args) : new weight_agent(args);
+}
+/**
+ * create an actor of 'master' from its arguments, which plays with 'snapshot' (see weight_agent::adopt)
+ */
+weight_agent* make_actor(const std::string& args, const weight_agent& master, const std::shared_ptr<const weight>& snapshot) {
+	if (argument(args, "search") == "expectimax") return new expectimax_agent(master, args, snapshot);
+	return new weight_agent(master, args, snapshot);
+}
+
+/**
+ * trajectory buffers of the player, reused by every episode
+ * the features of every afterstate are kept for update_weights, unless the player does not learn from them,
+ * in one buffer where each afterstate is both the state of one update and the afterstate of the previous one
+ */
+struct trajectory {
+	std::vector<features> index;
+	std::vector<int> rewards;
+
+	trajectory() {
+		index.reserve(10000);
+		rewards.reserve(10000);
+	}
+	void clear() {
+		index.clear();
+		rewards.clear();
+	}
+	bool keeps(const weight_agent& play) const {
+		return play.learning() && !play.online();
+	}
+	/**
+	 * append the afterstate of the player, where 'reward' is the reward of the slide leading to it (-1 if illegal)
+	 * its features are copied from 'known' or from the last choice of the player (see weight_agent::chosen),
+	 * and extracted only if neither has them
+	 */
+	void push(const weight_agent& play, const board& after, board::reward reward, const features* known = nullptr) {
+		if (index.size()) rewards.push_back(reward);
+		if (!known) known = play.chosen(after);
+		index.emplace_back();
+		if (known) index.back() = *known;
+		else play.extract(after, index.back());
+	}
+	void learn(weight_agent& play) {
+		play.update_weights(index, rewards);
+	}
+};
+
+/**
+ * the afterstates of an episode as packed boards, with the reward of the slide leading to each but the first
+ * played by an actor and sent to the learner, which replays it into a trajectory (see pipeline)
+ */
+struct packed {
+	std::vector<board::data> after;
+	std::vector<board::reward> rewards;
+	size_t version; // the snapshot played by the actor
+
+	packed() : version(0) {
+		after.reserve(10000);
+		rewards.reserve(10000);
+	}
+	void clear() {
+		after.clear();
+		rewards.clear();
+	}
+	bool keeps(const weight_agent& play) const {
+		return true;
+	}
+	void push(const weight_agent& play, const board& b, board::reward reward) {
+		if (after.size()) rewards.push_back(reward);
+		after.push_back(b.raw());
+	}
+	void learn(weight_agent& play) {}
+
+	/**
+	 * update the weights of 'play' as if it had played the episode itself
+	 */
+	void replay(weight_agent& play, trajectory& path) const {
+		path.clear();
+		for (size_t i = 0; i < after.size(); i++) path.push(play, board(after[i]), i ? rewards[i - 1] : 0);
+		path.learn(play);
+	}
+};
+
+/**
+ * play a training episode into 'stat' and update the weights of 'play' afterwards,
+ * or during the episode if 'play' learns online, in which case 'path' is left empty
+ * with a packed path, the episode is only recorded for a learner
+ * return the number of heap allocations made inside the move loop
+ *
+ * the agents are called by their (non-virtual) choose and place with the actual types,
+ * so that the moves of the loop are dispatched at compile time
+ */
+template<class player_type, class env_type, class path_type>
+size_t train_episode(statistic& stat, player_type& play, env_type& evil, path_type& path) {
+	action_code move;
+	int last_slide;
+	action_reward action_result;
+
+	play.open_episode("~:" + evil.name());
+	evil.open_episode(play.name() + ":~");
+	path.clear();
+
+	stat.open_episode(play.name() + ":" + evil.name());
+	episode& game = stat.back();
+	last_slide = -1;
+	size_t move_begin = allocs.load(std::memory_order_relaxed);
+	while (true) {
+		bool turn = game.player_turn();
+		if(turn){
+			last_slide = play.choose(game.state());
+			move = action_code::slide(last_slide);
+		}
+		else{
+			move = evil.place(game.state(),last_slide);
+		}
+		action_result = game.apply_action(move);
+		if (turn && path.keeps(play)){
+			path.push(play, game.state(), action_result.reward);
+		}
+		if (not action_result.legal_action) break;
+		if (turn ? play.player_type::check_for_win(game.state()) : evil.env_type::check_for_win(game.state())) break;
+	}
+	size_t move_end = allocs.load(std::memory_order_relaxed);
+	agent& win = game.last_turns(play, evil);
+	stat.close_episode(win.name());
+	path.learn(play);
+	play.close_episode(win.name());
+	evil.close_episode(win.name());
+	return move_end - move_begin;
+}
+
+/**
+ * play a training episode with the actual type of 'play'
+ */
+template<class path_type>
+size_t train_episode(statistic& stat, weight_agent& play, rndenv& evil, path_type& path) {
+	if (expectimax_agent* search = dynamic_cast<expectimax_agent*>(&play)) return train_episode(stat, *search, evil, path);
+	return train_episode<weight_agent, rndenv, path_type>(stat, play, evil, path);
+}
+
+/**
+ * games stepped in lockstep by one thread, to overlap the cache misses of their weight lookups (see --interleave)
+ * at every step, the features of the legal afterstates of all games are extracted and their weights prefetched,
+ * and only then are the afterstates evaluated and the moves applied
+ * every game has its own environment, where game (g) draws from the stream (seed, g) as in train_episode,
+ * and the weights are updated whenever a game is finished, so the greedy player must not learn online
+ */
+class interleaved {
+public:
+	interleaved(size_t games, const std::string& evil_args) : lanes(games) {
+		for (lane& l : lanes) l.evil.reset(new rndenv(evil_args));
+	}
+
+	/**
+	 * play the games given by 'next', which returns the id of the next game or size_t(-1) if there is none, into 'stat'
+	 */
+	template<class source_type>
+	void run(statistic& stat, weight_agent& play, source_type next) {
+		size_t active = 0;
+		for (lane& l : lanes) active += start(l, stat, play, next);
+		while (active) {
+			for (lane& l : lanes) {
+				if (!l.open) continue;
+				l.legal = l.game.state().expand(l.after, l.rewards);
+				for (unsigned rest = l.legal; rest; rest &= rest - 1) {
+					unsigned op = __builtin_ctz(rest);
+					l.index[op] = play.extract(l.after[op]);
+					play.prefetch(l.index[op]);
+				}
+			}
+			for (lane& l : lanes) {
+				if (!l.open) continue;
+				float value[4] = { 0, 0, 0, 0 };
+				for (unsigned rest = l.legal; rest; rest &= rest - 1) {
+					unsigned op = __builtin_ctz(rest);
+					value[op] = play.sum(l.index[op]);
+				}
+				int op = weight_agent::best(l.rewards, value, l.legal);
+				if (!step(l, play, op != -1 ? op : 0)) {
+					finish(l, stat, play);
+					active -= !start(l, stat, play, next);
+				}
+			}
+		}
+	}
+
+private:
+	/**
+	 * a game of the batch, which is open at the turn of the player
+	 */
+	struct lane {
+		episode game;
+		std::unique_ptr<rndenv> evil;
+		trajectory path;
+		int last_slide = -1;
+		bool open = false;
+		board after[4];
+		board::reward rewards[4];
+		features index[4];
+		unsigned legal = 0;
+	};
+
+	/**
+	 * open the next game on 'l', return false if there is none
+	 */
+	template<class source_type>
+	bool start(lane& l, statistic& stat, weight_agent& play, source_type& next) {
+		for (size_t g; (g = next()) != size_t(-1); ) {
+			l.evil->select(g);
+			play.open_episode("~:" + l.evil->name());
+			l.evil->open_episode(play.name() + ":~");
+			l.path.clear();
+			l.game.reset();
+			l.game.open_episode(play.name() + ":" + l.evil->name());
+			l.last_slide = -1;
+			if (advance(l)) return l.open = true;
+			finish(l, stat, play);
+		}
+		return l.open = false;
+	}
+	/**
+	 * apply slide (op) and the following placements, return false if the game is over
+	 */
+	bool step(lane& l, weight_agent& play, int op) {
+		l.last_slide = op;
+		action_reward result = l.game.apply_action(action_code::slide(op));
+		if (l.path.keeps(play)) l.path.push(play, l.game.state(), result.reward, result.legal_action ? &l.index[op] : nullptr);
+		if (!result.legal_action || play.weight_agent::check_for_win(l.game.state())) return false;
+		return advance(l);
+	}
+	/**
+	 * play the environment until the turn of the player, return false if the game is over
+	 */
+	bool advance(lane& l) {
+		while (!l.game.player_turn()) {
+			action_reward result = l.game.apply_action(l.evil->place(l.game.state(), l.last_slide));
+			if (!result.legal_action || l.evil->rndenv::check_for_win(l.game.state())) return false;
+		}
+		return true;
+	}
+	void finish(lane& l, statistic& stat, weight_agent& play) {
+		agent& win = l.game.last_turns(play, *l.evil);
+		l.game.close_episode(win.name());
+		stat.append(l.game);
+		l.path.learn(play);
+		play.close_episode(win.name());
+		l.evil->close_episode(win.name());
+	}
+
+	std::vector<lane> lanes;
+};
+
+/**
+ * move the episodes of the statistic of a worker thread into the shared 'stat' once it keeps 'bound' of them,
+ * so that the records held by a worker do not grow with the block (the rest is merged at the end of the block)
+ */
+void forward(statistic& stat, statistic& local, std::mutex& guard, size_t bound = 64) {
+	if (local.kept() < bound) return;
+	std::lock_guard<std::mutex> lock(guard);
+	stat.merge(local);
+}
+
+/**
+ * evaluate every player of 'contestants' (player arguments) with frozen weights on the same 'total' games,
+ * where game (g) is played against the environment stream (seed, g) (see rndenv), whichever worker plays it
+ * the games are split among 'threads' workers block by block, so that every block shows the same games
+ * the scores of the other players are compared game by game with the first one
+ * the weights are never saved, i.e., the 'save' of a player is ignored
+ */
+void evaluate(const std::vector<std::string>& contestants, const std::string& evil_args, size_t total, size_t block,
+		size_t threads, board::reward target, bool summary, const std::string& save, const std::string& text) {
+	std::vector<std::vector<board::reward>> scores(contestants.size(), std::vector<board::reward>(total));
+	for (size_t c = 0; c < contestants.size(); c++) {
+		std::string suffix = contestants.size() > 1 ? "." + std::to_string(c) : "";
+		std::cout << "eval #" << c << ": " << contestants[c] << std::endl;
+		std::unique_ptr<weight_agent> master(make_player(without(contestants[c], "save") + " frozen=1"));
+		statistic stat(total, block, text.size() ? 0 : 1);
+		stat.set_target(target);
+		if (save.size() && !stat.stream(save + suffix)) {
+			std::cerr << "cannot save records: " << save + suffix << std::endl;
+			std::exit(1);
+		}
+
+		std::vector<std::unique_ptr<weight_agent>> players;
+		std::vector<std::unique_ptr<rndenv>> envs;
+		std::vector<std::unique_ptr<statistic>> stats;
+		std::vector<trajectory> paths(threads);
+		for (size_t k = 0; k < threads; k++) {
+			players.emplace_back(make_player(contestants[c], master.get()));
+			envs.emplace_back(new rndenv(evil_args));
+			stats.emplace_back(new statistic(size_t(-1), size_t(-1), size_t(-1)));
+		}
+		while (!stat.is_finished()) {
+			size_t begin = stat.size(), round = std::min(block - begin % block, total - begin);
+			std::atomic<size_t> ticket(0);
+			std::mutex guard; // of 'stat', see forward
+			std::vector<std::thread> workers;
+			for (size_t k = 0; k < threads; k++) {
+				workers.emplace_back([&, k]() {
+					for (size_t g; (g = ticket.fetch_add(1, std::memory_order_relaxed)) < round; ) {
+						envs[k]->select(begin + g);
+						train_episode(*stats[k], *players[k], *envs[k], paths[k]);
+						scores[c][begin + g] = stats[k]->back().score();
+						forward(stat, *stats[k], guard);
+					}
+				});
+			}
+			for (std::thread& worker : workers) worker.join();
+			for (size_t k = 0; k < threads; k++) stat.merge(*stats[k]);
+		}
+		if (summary) stat.summary();
+		if (text.size()) {
+			std::ofstream out(text + suffix, std::ios::out | std::ios::trunc);
+			out << stat;
+		}
+	}
+
+	for (size_t c = 1; c < contestants.size(); c++) {
+		// the mean of the paired differences, with its 95% confidence interval
+		double sum = 0, square = 0;
+		size_t wins = 0, losses = 0;
+		for (size_t g = 0; g < total; g++) {
+			double diff = double(scores[c][g]) - scores[0][g];
+			sum += diff;
+			square += diff * diff;
+			wins += diff > 0;
+			losses += diff < 0;
+		}
+		double mean = total ? sum / total : 0;
+		double error = total > 1 ? std::sqrt((square - sum * mean) / (total - 1) / total) : 0;
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::fixed << std::setprecision(1) << std::showpos;
+		std::cout << "eval #" << c << " vs #0: mean difference = " << mean << " (" << std::noshowpos << "+/-" << 1.96 * error << ")";
+		std::cout << ", wins = " << wins << ", losses = " << losses << ", ties = " << (total - wins - losses);
+		std::cout << " over " << total << " games" << std::endl;
+		std::cout.copyfmt(ff);
+	}
+}
+
 int main(int argc, const char* argv[]) {
 	std::cout << "Thress-Demo: ";
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
@@ -23,8 +421,16 @@ int main(int argc, const char* argv[]) {
 
 	size_t total = 5000, block = 0, limit = 0;
 	std::string play_args, evil_args;
-	std::string load, save;
+	std::string load, save, text, profile;
 	bool summary = false;
+	bool count_allocs = false;
+	bool eval = false;
+	bool pipeline = false;
+	size_t sync = 100;
+	size_t interleave = 1;
+	std::vector<std::string> contestants;
+	size_t threads = 0;
+	board::reward target = 0;
 	for (int i = 1; i < argc; i++) {
 		std::string para(argv[i]);
 		if (para.find("--total=") == 0) {
@@ -35,80 +441,241 @@ int main(int argc, const char* argv[]) {
 			limit = std::stoull(para.substr(para.find("=") + 1));
 		} else if (para.find("--play=") == 0) {
 			play_args = para.substr(para.find("=") + 1);
+			contestants.push_back(play_args);
 		} else if (para.find("--evil=") == 0) {
 			evil_args = para.substr(para.find("=") + 1);
 		} else if (para.find("--load=") == 0) {
 			load = para.substr(para.find("=") + 1);
 		} else if (para.find("--save=") == 0) {
 			save = para.substr(para.find("=") + 1);
+		} else if (para.find("--export=") == 0) {
+			text = para.substr(para.find("=") + 1);
+		} else if (para.find("--profile=") == 0) {
+			profile = para.substr(para.find("=") + 1);
 		} else if (para.find("--summary") == 0) {
 			summary = true;
+		} else if (para.find("--eval") == 0) {
+			eval = true;
+		} else if (para.find("--pipeline") == 0) {
+			pipeline = true;
+		} else if (para.find("--interleave=") == 0) {
+			interleave = std::max(std::stoull(para.substr(para.find("=") + 1)), 1ull);
+		} else if (para.find("--sync=") == 0) {
+			sync = std::max(std::stoull(para.substr(para.find("=") + 1)), 1ull);
+		} else if (para.find("--count-allocs") == 0) {
+			count_allocs = true;
+		} else if (para.find("--target=") == 0) {
+			target = std::stoi(para.substr(para.find("=") + 1));
+		} else if (para.find("--threads=") == 0) {
+			threads = std::max(std::stoull(para.substr(para.find("=") + 1)), 1ull);
 		}
 	}
 
-	statistic stat(total, block, limit);
+	if (eval) {
+		// with --eval, every --play is a contestant, played by all cores unless --threads is given
+		if (contestants.empty()) contestants.push_back(play_args);
+		if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+		evaluate(contestants, evil_args, total, block ? block : total, threads, target, summary, save, text);
+		return 0;
+	}
+	threads = std::max(threads, size_t(1));
+
+	// the records are streamed by --save, so they are kept only for --export
+	statistic stat(total, block, text.size() ? limit : 1);
+	stat.set_target(target);
+	if (block == 0) block = total;
 
+	// the loaded records are copied into the file of --save, unless it is the same file, which is appended instead
+	bool resume = save.size() && save == load;
+	if (save.size() && !resume && !stat.stream(save)) {
+		std::cerr << "cannot save records: " << save << std::endl;
+		std::exit(1);
+	}
 	if (load.size()) {
-		std::ifstream in(load, std::ios::in);
-		in >> stat;
-		in.close();
+		if (!stat.load(load)) {
+			// e.g., the last record of an interrupted run
+			std::cerr << "ignored a malformed record at the end of " << load << std::endl;
+		}
 		summary |= stat.is_finished();
 	}
+	if (resume && !stat.stream(save, true)) {
+		std::cerr << "cannot append records to " << save << " (not in the binary format)" << std::endl;
+		std::exit(1);
+	}
 
-	weight_agent play(play_args);
-	rndenv evil(evil_args);
-	action move;
-	int last_slide;
-	action_op player_move;
-	action_reward action_result;
-	while (!stat.is_finished()) {
-		play.open_episode("~:" + evil.name());
-		evil.open_episode(play.name() + ":~");
-
-		std::vector<std::vector<int>> state_index;
-		std::vector<std::vector<int>> after_state_index;
-		std::vector<int> rewards;
-
-		stat.open_episode(play.name() + ":" + evil.name());
-		episode& game = stat.back();
-		last_slide = -1;
-		std::vector<int> state;
-		while (true) {
-			agent& who = game.take_turns(play, evil);
-			if(who.role().compare("player") == 0){
-				player_move = who.take_action2(game.state());
-				last_slide = player_move.op;	
-				move = player_move.s;
-			}
-			else{
+	std::unique_ptr<weight_agent> player(make_player(play_args));
+	weight_agent& play = *player;
+	if (interleave > 1 && (pipeline || dynamic_cast<expectimax_agent*>(&play) || play.online())) {
+		std::cerr << "--interleave needs the greedy player learning from whole episodes, without --pipeline" << std::endl;
+		std::exit(1);
+	}
 
-				move = who.take_action(game.state(),last_slide);
+	if (pipeline) {
+		// actor k plays with its own environment and its own statistic like the workers below, but with a snapshot of the weights,
+		// and sends the afterstates of every episode to the learner (this thread), which is the only one to update 'play'
+		// and publishes a new snapshot every 'sync' episodes; the buffers circulate between the actors and the learner in two rings
+		if (!play.learning() || play.online()) {
+			std::cerr << "the pipeline needs a player learning from whole episodes" << std::endl;
+			std::exit(1);
+		}
+		std::shared_ptr<const weight> latest = play.snapshot();
+		std::atomic<size_t> version(0);
+		std::vector<std::unique_ptr<weight_agent>> actors;
+		std::vector<std::unique_ptr<rndenv>> envs;
+		std::vector<std::unique_ptr<statistic>> stats;
+		for (size_t k = 0; k < threads; k++) {
+			actors.emplace_back(make_actor(play_args, play, latest));
+			envs.emplace_back(new rndenv(evil_args));
+			stats.emplace_back(new statistic(size_t(-1), size_t(-1), size_t(-1)));
+		}
+		std::vector<packed> buffers(4 * threads);
+		ring<packed*> full(buffers.size()), empty(buffers.size());
+		for (packed& p : buffers) empty.push(&p);
+		trajectory path;
+
+		size_t learned = 0, lag = 0, learner_waits = 0;
+		std::atomic<size_t> actor_waits(0);
+		while (!stat.is_finished()) {
+			size_t begin = stat.size(), round = std::min(block - begin % block, total - begin);
+			std::atomic<size_t> ticket(0);
+			std::mutex guard; // of 'stat', see forward
+			std::vector<std::thread> workers;
+			for (size_t k = 0; k < threads; k++) {
+				workers.emplace_back([&, k]() {
+					std::shared_ptr<const weight> current; // 'latest' is read only by atomic_load, and adopted at the first episode
+					size_t waits = 0;
+					for (size_t g; (g = ticket.fetch_add(1, std::memory_order_relaxed)) < round; ) {
+						size_t seen = version.load(std::memory_order_acquire);
+						std::shared_ptr<const weight> snapshot = std::atomic_load(&latest);
+						if (snapshot != current) {
+							current = snapshot;
+							actors[k]->adopt(current);
+						}
+						packed* buffer;
+						waits += empty.pop(buffer);
+						buffer->version = seen;
+						envs[k]->select(begin + g);
+						train_episode(*stats[k], *actors[k], *envs[k], *buffer);
+						waits += full.push(buffer);
+						forward(stat, *stats[k], guard);
+					}
+					actor_waits += waits;
+				});
 			}
-			action_result = game.apply_action(move);
-			if (who.role().compare("player") == 0){
-				if(state.size() == 0){
-					state = game.state().features();
-				}else{
-					state_index.push_back(state);
-					after_state_index.push_back(game.state().features());
-					rewards.push_back(action_result.reward);
-					state = game.state().features();
+			for (size_t n = 0; n < round; n++) {
+				packed* buffer;
+				learner_waits += full.pop(buffer);
+				lag += version.load(std::memory_order_relaxed) - buffer->version;
+				buffer->replay(play, path);
+				empty.push(buffer);
+				if (++learned % sync == 0) {
+					std::atomic_store(&latest, play.snapshot());
+					version.fetch_add(1, std::memory_order_release);
 				}
 			}
-			if (not action_result.legal_action or who.check_for_win(game.state())) break;
+			for (std::thread& worker : workers) worker.join();
+			for (size_t k = 0; k < threads; k++) stat.merge(*stats[k]);
+		}
+		std::cout << "pipeline: " << threads << " actors, " << learned << " episodes learned, ";
+		std::cout << (learned / sync) << " snapshots, mean lag = " << (learned ? double(lag) / learned : 0.0) << " snapshots, ";
+		std::cout << "waits = " << actor_waits << " (actors) " << learner_waits << " (learner)" << std::endl;
+
+	} else if (threads > 1) {
+		// worker k plays with its own environment and its own statistic, where game (g) draws from the stream (seed, g),
+		// while all workers update the weight tables of 'play' without locking
+		std::vector<std::unique_ptr<weight_agent>> players;
+		std::vector<std::unique_ptr<rndenv>> envs;
+		std::vector<std::unique_ptr<statistic>> stats;
+		std::vector<trajectory> paths(threads);
+		std::vector<std::unique_ptr<interleaved>> batches;
+		for (size_t k = 0; k < threads; k++) {
+			players.emplace_back(make_player(play_args, &play));
+			envs.emplace_back(new rndenv(evil_args));
+			stats.emplace_back(new statistic(size_t(-1), size_t(-1), size_t(-1)));
+			if (interleave > 1) batches.emplace_back(new interleaved(interleave, evil_args));
+		}
+
+		// run block by block, so that the merged statistic is shown at the same points as a single thread
+		size_t allocs_begin = allocs.load(std::memory_order_relaxed), played = 0;
+		while (!stat.is_finished()) {
+			size_t begin = stat.size(), round = std::min(block - begin % block, total - begin);
+			std::atomic<size_t> ticket(0);
+			std::mutex guard; // of 'stat', see forward
+			std::vector<std::thread> workers;
+			for (size_t k = 0; k < threads; k++) {
+				workers.emplace_back([&, k]() {
+					if (interleave > 1) {
+						batches[k]->run(*stats[k], *players[k], [&]() {
+							forward(stat, *stats[k], guard); // between the episodes of the batch
+							size_t g = ticket.fetch_add(1, std::memory_order_relaxed);
+							return g < round ? begin + g : size_t(-1);
+						});
+						return;
+					}
+					for (size_t g; (g = ticket.fetch_add(1, std::memory_order_relaxed)) < round; ) {
+						envs[k]->select(begin + g);
+						train_episode(*stats[k], *players[k], *envs[k], paths[k]);
+						forward(stat, *stats[k], guard);
+					}
+				});
+			}
+			for (std::thread& worker : workers) worker.join();
+			for (size_t k = 0; k < threads; k++) stat.merge(*stats[k]);
+			played += round;
+		}
+		if (count_allocs) {
+			size_t allocs_end = allocs.load(std::memory_order_relaxed);
+			std::cout << "allocs: per episode = " << (played ? double(allocs_end - allocs_begin) / played : 0.0);
+			std::cout << " over " << played << " episodes in " << threads << " threads" << std::endl;
+		}
+
+	} else if (interleave > 1) {
+		// the games of the set are played in lockstep batches, continuing the game set after the loaded episodes
+		interleaved batch(interleave, evil_args);
+		size_t game = stat.size();
+		batch.run(stat, play, [&]() { return game < total ? game++ : size_t(-1); });
+
+	} else {
+		rndenv evil(evil_args);
+		trajectory path;
+		if (stat.size()) evil.select(stat.size()); // continue the game set after the loaded episodes
+
+		// allocations counted inside the move loop and in the whole episode, excluding the first (warm-up) episode
+		size_t warmup_allocs = 0, move_allocs = 0, episode_allocs = 0, max_episode_allocs = 0, counted = 0;
+		bool warm = false;
+		while (!stat.is_finished()) {
+			size_t episode_begin = allocs.load(std::memory_order_relaxed);
+			size_t loop_allocs = train_episode(stat, play, evil, path);
+			size_t episode_end = allocs.load(std::memory_order_relaxed);
+			if (!warm) {
+				warmup_allocs = episode_end - episode_begin;
+				warm = true;
+			} else {
+				move_allocs += loop_allocs;
+				episode_allocs += episode_end - episode_begin;
+				max_episode_allocs = std::max(max_episode_allocs, episode_end - episode_begin);
+				counted++;
+			}
+		}
+		if (count_allocs) {
+			std::cout << "allocs: warm-up = " << warmup_allocs;
+			std::cout << ", per episode = " << (counted ? double(episode_allocs) / counted : 0.0);
+			std::cout << " (max " << max_episode_allocs << ")";
+			std::cout << ", in move loop = " << move_allocs;
+			std::cout << " over " << counted << " episodes" << std::endl;
 		}
-		agent& win = game.last_turns(play, evil);
-		stat.close_episode(win.name());
-		play.update_weights(state_index, rewards, after_state_index);
-		play.close_episode(win.name());
-		evil.close_episode(win.name());
 	}
+
 	if (summary) {
 		stat.summary();
 	}
 
-	if (save.size()) {
-		std::ofstream out(save, std::ios::out | std::ios::trunc);
+	if (profile.size() && !PROFILE_DUMP(profile)) {
+		std::cerr << "cannot dump the profile to " << profile << " (compile with 'make profile')" << std::endl;
+	}
+
+	if (text.size()) {
+		std::ofstream out(text, std::ios::out | std::ios::trunc);
 		out << stat;
 		out.close();
 	}
@@ -2,6 +2,8 @@
 #include <algorithm>
 #include <unordered_map>
 #include <string>
+#include <cstdint>
+#include <type_traits>
 #include "board.h"
 
 class action {
@@ -114,3 +116,33 @@ protected:
 	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) place(*a); }
 	static __attribute__((constructor)) void init() { entries()[type_flag('p')] = new place; }
 };
+
+/**
+ * trivially copyable encoding of an action, used by the compiled play loop instead of the dynamic action
+ * the layout is the code byte of the binary record: slide 1000 00dd, place 00TT pppp, and none 0xff
+ */
+struct action_code {
+	uint8_t code;
+
+	static action_code slide(unsigned op) { return { uint8_t(0x80 | (op & 0b11)) }; }
+	static action_code place(unsigned pos, unsigned tile) { return { uint8_t(((tile & 0b11) << 4) | (pos & 0x0f)) }; }
+	static action_code none() { return { 0xff }; }
+
+	bool is_slide() const { return (code & 0xc0) == 0x80; }
+	bool is_place() const { return (code & 0xc0) == 0; }
+	unsigned op() const { return code & 0b11; }
+	unsigned position() const { return code & 0x0f; }
+	unsigned tile() const { return (code >> 4) & 0b11; }
+
+	board::reward apply(board& b) const {
+		if (is_slide()) return b.slide(op());
+		if (is_place()) return b.place(position(), tile());
+		return -1;
+	}
+	operator action() const {
+		if (is_slide()) return action::slide(op());
+		if (is_place()) return action::place(position(), tile());
+		return action();
+	}
+};
+static_assert(std::is_trivially_copyable<action_code>::value, "action_code must be trivially copyable");
@@ -5,9 +5,15 @@
 #include <map>
 #include <type_traits>
 #include <algorithm>
+#include <memory>
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "network.h"
+#include "quantize.h"
+#include "census.h"
+#include "compact.h"
+#include "rng.h"
 
 struct action_op{
 	action s;
@@ -71,14 +77,93 @@ protected:
  * add a new random tile to an empty cell
  * 2-tile: 90%
  * 4-tile: 10%
+ *
+ * for threes, the tile is drawn from a bag of {1, 2, 3} (refilled once empty),
+ * and placed on an empty cell of the edge opposite to the player's slide
+ * the random numbers of episode (id) come from the counter-based stream (seed, id), where the id counts the episodes
+ * of the environment unless given by select(), so that a game set is the same however it is split among threads
+ * with 'rng=legacy', the environment draws from a single std::default_random_engine as before
+ *
+ * the placements can also be enumerated with their probabilities (see outcomes), e.g., for the chance nodes of a search
  */
 class rndenv : public random_agent {
 public:
+	/**
+	 * a placement of the environment with its probability, and the state of the environment after it (see pack)
+	 */
+	struct outcome {
+		action_code move;
+		float probability;
+		board::data state;
+	};
+	static constexpr size_t max_outcomes = 16 * 3;
+	static constexpr unsigned full_bag = 0b111;
+
+	/**
+	 * the compact state of the environment, which fits in board::info():
+	 * bits [0, 3) are the bag, where bit (t - 1) is tile (t), and bits [3, 6) are the last slide of the player + 1,
+	 * which is 0 before the first slide, when a tile may be placed on any empty cell
+	 */
+	static board::data pack(unsigned bag, int slide) {
+		return (bag & full_bag) | (board::data(slide + 1) << 3);
+	}
+	static unsigned bag_of(board::data state) { return state & full_bag; }
+	static int slide_of(board::data state) { return int((state >> 3) & 0b111) - 1; }
+	/**
+	 * the bag after drawing 'tile' from 'bag', refilled once it becomes empty
+	 */
+	static unsigned draw(unsigned bag, board::cell tile) {
+		bag &= ~(1u << (tile - 1));
+		return bag ? bag : full_bag;
+	}
+	/**
+	 * list every placement on 'after' into 'out', where after.info() is the state of the environment,
+	 * without allocation or random numbers; return the number of outcomes, which is 0 if no tile can be placed
+	 * a cell is chosen uniformly from the empty cells allowed by the last slide, and a tile uniformly from the bag,
+	 * so all outcomes are equally likely
+	 */
+	static size_t outcomes(const board& after, outcome (&out)[max_outcomes]) {
+		board::data state = after.info();
+		int slide = slide_of(state);
+		unsigned empty = after.empty_cells() & (slide == -1 ? 0xffffu : edge[slide & 0b11]);
+		unsigned bag = bag_of(state) ? bag_of(state) : full_bag;
+		size_t n = 0;
+		for (; empty; empty &= empty - 1) {
+			unsigned pos = __builtin_ctz(empty);
+			for (unsigned rest = bag; rest; rest &= rest - 1) {
+				board::cell tile = __builtin_ctz(rest) + 1;
+				out[n].move = action_code::place(pos, tile);
+				out[n].state = pack(draw(bag, tile), -1);
+				n++;
+			}
+		}
+		for (size_t i = 0; i < n; i++) out[i].probability = 1.0f / n;
+		return n;
+	}
+	/**
+	 * the state of this environment, before placing a tile after 'player_slide' (see pack)
+	 */
+	board::data state(int player_slide) const {
+		if (!legacy) return pack(tiles, player_slide);
+		unsigned left = 0;
+		for (size_t i = 0; i < bag_size; i++) left |= 1u << (bag[i] - 1);
+		return pack(left ? left : full_bag, player_slide);
+	}
+
 	rndenv(const std::string& args = "") : random_agent("name=random role=environment " + args),
 		space({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }),popup(0,9) {
 		initial_bag();
+		legacy = meta.count("rng") && std::string(meta["rng"]) == "legacy";
+		if (meta.count("rng") && !legacy && std::string(meta["rng"]) != "counter") {
+			std::cerr << "unknown rng: " << std::string(meta["rng"]) << std::endl;
+			std::exit(1);
+		}
+		seed = meta.count("seed") ? uint64_t(meta["seed"]) : 1;
+		id = 0;
+		tiles = full_bag;
 		}
 	virtual action take_action(const board& after){
+		PROFILE_SCOPE(place);
 		std::shuffle(space.begin(), space.end(), engine);
                 for (int pos : space) {
                         if (after(pos) != 0) continue;
@@ -88,72 +173,117 @@ public:
                 return action();
 	}
 	virtual action take_action(const board& after, int player_slide) {
+		return place(after, player_slide);
+	}
+	/**
+	 * place a tile after the player's slide (or on any empty cell for the first tiles, where 'player_slide' is -1)
+	 * the non-virtual entry of take_action for the compiled play loop
+	 */
+	action_code place(const board& after, int player_slide) {
+		PROFILE_SCOPE(place);
+		if (legacy) return place_legacy(after, player_slide);
+		unsigned empty = after.empty_cells() & (player_slide == -1 ? 0xffffu : edge[player_slide & 0b11]);
+		if (empty == 0) return action_code::none();
+		for (unsigned skip = rng.below(__builtin_popcount(empty)); skip; skip--) empty &= empty - 1;
+		unsigned pos = __builtin_ctz(empty);
+		unsigned bag = tiles;
+		for (unsigned skip = rng.below(__builtin_popcount(bag)); skip; skip--) bag &= bag - 1;
+		unsigned tile = __builtin_ctz(bag) + 1;
+		tiles = draw(tiles, tile);
+		return action_code::place(pos, tile);
+	}
+	/**
+	 * play episode (id) next, i.e., draw its random numbers from the stream (seed, id)
+	 * with 'rng=legacy', the engine is reseeded by the same stream instead
+	 */
+	void select(uint64_t episode) {
+		id = episode;
+		if (legacy) engine.seed(unsigned(counter_rng::stream(seed, id)()));
+	}
+	virtual void open_episode(const std::string& flag = "") {
+		initial_bag();
+		tiles = full_bag;
+		rng = counter_rng::stream(seed, id++);
+	}
+
+protected:
+	action_code place_legacy(const board& after, int player_slide) {
 		std::shuffle(space.begin(), space.end(), engine);
-		std::vector<int> empty;
+		std::array<int, 16> empty;
+		size_t n = 0;
 
 		if (player_slide != -1){
 			//printf("player slide %d",player_slide);
 			if (player_slide == 0){
 				for(int i = 12 ;i < 16 ;i++){
 					if(after(i)==0)
-						empty.push_back(i);
+						empty[n++] = i;
 				}
 			}else if(player_slide == 1){
 				for(int i = 0 ;i<4;i++){
 					if(after(i*4)== 0)
-						empty.push_back(i * 4);
+						empty[n++] = i * 4;
 				}
 			}else if(player_slide == 2){
 				for(int i = 0;i<4;i++){
 					if(after(i) == 0){
-						empty.push_back(i);
+						empty[n++] = i;
 					}
 				}
 			}else if (player_slide == 3){
 				for(int i = 0 ;i<4;i++){
 					if(after(i * 4 + 3) == 0){
-						empty.push_back(4 * i + 3);
+						empty[n++] = 4 * i + 3;
 					}
 				}
 			}
 		}else{
 			for(int i = 0;i<16;i++){
 				if(after(i) == 0){
-					empty.push_back(i);
+					empty[n++] = i;
 				}
 			}
 		}
-		if (empty.size() != 0){
-			std::shuffle(empty.begin(), empty.end(), engine);
+		if (n != 0){
+			std::shuffle(empty.begin(), empty.begin() + n, engine);
 			int pos = empty[0];
 			board::cell tile = choose_tile();
-			return action::place(pos, tile);
+			return action_code::place(pos, tile);
 		}
-		return action();
+		return action_code::none();
 	}
 	void initial_bag(){
-		std::vector<int> new_bag;
-		bag = new_bag;
-		bag.push_back(1);
-		bag.push_back(2);
-		bag.push_back(3);
+		bag = {{ 1, 2, 3 }};
+		bag_size = 3;
 	}
 	board::cell choose_tile(){
-		if (bag.size()==0)
+		if (bag_size==0)
 			initial_bag();
-		std::shuffle(bag.begin(), bag.end(),engine);		
+		std::shuffle(bag.begin(), bag.begin() + bag_size, engine);
 		board::cell tile = bag[0];
-		bag.erase(bag.begin());
+		std::copy(bag.begin() + 1, bag.begin() + bag_size, bag.begin());
+		bag_size--;
 		return tile;
 	}
-	virtual void open_episode(const std::string& flag = "") {initial_bag();}
 
 
 private:
 	std::array<int, 16> space;
-	std::vector<int> bag;
+	std::array<int, 3> bag;
+	size_t bag_size;
 	std::uniform_int_distribution<int> popup;
+
+	static const unsigned edge[4];
+	bool legacy;
+	uint64_t seed;
+	uint64_t id; // the next episode
+	counter_rng rng;
+	unsigned tiles; // the bag as a bitset, where bit (t - 1) is tile (t), never empty
 };
+constexpr size_t rndenv::max_outcomes;
+constexpr unsigned rndenv::full_bag;
+// the cells of the edge opposite to slide up, right, down, and left
+const unsigned rndenv::edge[4] = { 0xf000, 0x1111, 0x000f, 0x8888 };
 
 /**
  * dummy player
@@ -166,13 +296,12 @@ public:
 
 	virtual action_op take_action2(const board& before) {
 		std::shuffle(opcode.begin(), opcode.end(), engine);
+		unsigned legal = before.legal_moves();
 		action_op output;
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
-			action s = action::slide(op);
-			output.s = s;
+			output.s = action::slide(op);
 			output.op = op;
-			if (reward != -1) return output;
+			if (legal & (1u << op)) return output;
 		}
 		output.s = action();
 		output.op = -1;
@@ -188,45 +317,198 @@ protected:
 
 class weight_agent: public player{
 public:
-	weight_agent(const std::string& args =  "", int num_feature = 8): player(args), num_feature(num_feature){
-		alpha = 1.0 / 32.0;
+	/**
+	 * the network is set by 'tuples' and 'iso' (see network), e.g., 'tuples=4x6'
+	 * the learning rate 'alpha' is 0.25 / (features per board) by default, i.e., 1/32 for the 8 lines
+	 * with 'frozen=1', the weights are mapped read-only (shared with other processes) and never updated
+	 * with 'quantize=int16' or 'quantize=float16', the network is evaluated with 16-bit tables (implies frozen);
+	 * the first 'reference=10' episodes are played by the float network to report the divergence,
+	 * which needs a single greedy player, i.e., 'reference=0' is required with search=expectimax, --eval, and --threads
+	 *
+	 * the learning mode is TD(0) by default, and can be changed by
+	 *  'lambda=0.5': TD(lambda), with the lambda-return computed backward over the finished episode
+	 *  'coherence=1': temporal coherence, i.e., an adaptive learning rate for every weight
+	 *  'stages=384,768': a separate set of weights whenever the largest tile reaches each of the tiles
+	 * with 'online=1', each TD(0) update is applied as soon as the next afterstate is chosen (see follow)
+	 * with 'simd=scalar' or 'simd=avx2', the evaluation kernel of all networks is forced (see network::kernel)
+	 * with 'fixed=0', the scalar kernel evaluates the network generically even if its shape is specialised (see fixed.h)
+	 * with 'compact=1', the network is evaluated without its untrained lines of weights (see compact.h, implies frozen),
+	 * and saved in the compact format, which is also loaded as such
+	 * with 'census=report.json' (or .csv), the lookups and updates of every weight are counted (see census),
+	 * and reported at the end
+	 */
+	weight_agent(const std::string& args =  ""): player(args),
+		shared(std::make_shared<network>(meta.count("tuples") ? std::string(meta["tuples"]) : "", meta.count("iso") ? int(meta["iso"]) : -1,
+			meta.count("stages") ? std::string(meta["stages"]) : "")), net(*shared){
+		frozen = (meta.count("frozen") && int(meta["frozen"])) || meta.count("quantize") || (meta.count("compact") && int(meta["compact"]));
+		lambda = meta.count("lambda") ? float(meta["lambda"]) : 0;
+		learn_online = meta.count("online") && int(meta["online"]);
+		pending = false;
+		reference = 0;
+		if (learn_online && lambda > 0){
+			std::cerr << "online learning supports TD(0) only" << std::endl;
+			std::exit(1);
+		}
+		if (meta.count("simd") && !network::use(meta["simd"])){
+			std::cerr << "unsupported simd: " << std::string(meta["simd"]) << std::endl;
+			std::exit(1);
+		}
 		if (meta.find("init") != meta.end()){
 			init_weights(meta["init"]);
 		}
 		if (meta.find("load") != meta.end()){
 			load_weights(meta["load"]);
 		}
+		// the layout may come from the loaded file, so the default rate is set by the final network
+		alpha = meta.count("alpha") ? float(meta["alpha"]) : 0.25f / net.extract(board()).size();
+		if (meta.count("fixed") && !int(meta["fixed"])){
+			net.specialise(false); // likewise, since a network rebuilt from the file picks its specialised shape again
+		}
+		if (meta.count("coherence") && int(meta["coherence"]) && !frozen){
+			net.coherence();
+		}
+		if (meta.count("compact") && int(meta["compact"]) && !pack){
+			pack = std::make_shared<compacted>(net);
+			std::cout << "compact: " << (net.size() * sizeof(float) >> 10) << "KB -> " << (pack->bytes() >> 10) << "KB, ";
+			std::cout << pack->lines() << " of " << pack->total() << " lines kept" << std::endl;
+			net.release();
+		}
+		if (meta.find("quantize") != meta.end()){
+			if (pack){
+				std::cerr << "cannot quantize compact weights" << std::endl;
+				std::exit(1);
+			}
+			quant = std::make_shared<quantized>(net, meta["quantize"]);
+			reference = meta.count("reference") ? int(meta["reference"]) : 10;
+		}
+		if (meta.count("census")){
+			tally = std::make_shared<census>(net);
+		}
+	}
+	/**
+	 * a worker agent that shares the weight tables of 'master'
+	 * the tables are updated without locking (Hogwild), and the worker never loads or saves them
+	 */
+	weight_agent(const weight_agent& master, const std::string& args): player(args),
+		shared(master.shared), net(*shared), quant(master.quant), pack(master.pack), tally(master.tally), alpha(master.alpha), lambda(master.lambda),
+		frozen(master.frozen), learn_online(master.learn_online), pending(false), reference(0){
+		if (master.reference){
+			// the workers never play the reference episodes, so the divergence would not be reported
+			std::cerr << "the reference episodes of quantize need a single player, use reference=0" << std::endl;
+			std::exit(1);
+		}
+		meta.erase("init");
+		meta.erase("load");
+		meta.erase("save");
+		meta.erase("census");
+	}
+	/**
+	 * an actor agent that plays with snapshots of the weights of 'master' (see adopt) in a network of its own,
+	 * so that the weights of 'master' may be updated meanwhile; an actor never updates, loads, or saves weights
+	 */
+	weight_agent(const weight_agent& master, const std::string& args, const std::shared_ptr<const weight>& snapshot): player(args),
+		shared(std::make_shared<network>(master.net.tuples(), int(master.net.iso()), master.net.stage_tiles())), net(*shared),
+		tally(master.tally), alpha(master.alpha), lambda(master.lambda), frozen(true), learn_online(false), pending(false), reference(0){
+		meta.erase("init");
+		meta.erase("load");
+		meta.erase("save");
+		meta.erase("census");
+		adopt(snapshot);
 	}
 	virtual ~weight_agent(){
+		if (reference && ref.positions) report();
+		if (tally && meta.count("census")){
+			tally->show(std::cout);
+			if (!tally->dump(meta["census"])) std::cerr << "cannot write the census to " << std::string(meta["census"]) << std::endl;
+		}
 		if (meta.find("save")!=meta.end()){
 			save_weights(meta["save"]);
 		}
 	}
 
+	virtual void open_episode(const std::string& flag = ""){
+		pending = false;
+	}
+	virtual void close_episode(const std::string& flag = ""){
+		if (reference && --reference == 0) report();
+	}
+	/**
+	 * whether the weights are updated during the episode, so that no trajectory has to be kept
+	 */
+	bool online() const { return learn_online && !frozen; }
+	/**
+	 * whether the weights are updated at all
+	 */
+	bool learning() const { return !frozen; }
+	/**
+	 * whether the network is evaluated by a specialised shape on the scalar kernel (see fixed.h)
+	 */
+	bool specialised() const { return net.specialised(); }
+
+	/**
+	 * a copy of the current weights, for actors (see adopt)
+	 */
+	std::shared_ptr<const weight> snapshot() const { return net.snapshot(); }
+	/**
+	 * play with 'snapshot' from now on, which must be taken from a network of the same layout
+	 */
+	void adopt(const std::shared_ptr<const weight>& snapshot){
+		if (!net.share(snapshot)){
+			std::cerr << "cannot adopt weights of a different layout" << std::endl;
+			std::exit(1);
+		}
+	}
+
 protected:
 	virtual void init_weights(const std::string& info){
-		for (int i = 0 ;i<num_feature; i++){
-			net.emplace_back(65536);
-		}
+		net.init();
 	}
 
+	/**
+	 * load the weights, either by mapping a file in the mapped format or by reading a stream-format file
+	 * a mapped file also provides the layout, unless 'tuples' is given explicitly
+	 * with 'verify=1', the checksum of the mapped weights is checked
+	 * a file in the compact format is evaluated as such (see compacted), and implies frozen
+	 */
 	virtual void load_weights(const std::string& path){
+		network::header h;
+		if (network::probe(path, h)){
+			if (!meta.count("tuples")){
+				std::string tuples;
+				for (size_t i = 0; i < h.tables; i++){
+					if (tuples.size()) tuples += ',';
+					for (size_t j = 1; j <= h.shape[i][0]; j++) tuples += "0123456789abcdef"[h.shape[i][j] & 0x0f];
+				}
+				std::string stages;
+				for (size_t i = 0; i < 4 && h.stage[i]; i++){
+					stages += (stages.size() ? "," : "") + std::to_string(board::index_to_tile[h.stage[i] & 0x0f]);
+				}
+				net = network(tuples, h.iso, stages);
+			}
+			bool verify = meta.count("verify") && int(meta["verify"]);
+			if (h.version == compacted::version){
+				pack = compacted::load(path, net, verify);
+				if (!pack){
+					std::cerr << "cannot load compact weights: " << path << std::endl;
+					std::exit(-1);
+				}
+				frozen = true;
+				return;
+			}
+			if (!net.map(path, !frozen, verify)){
+				std::cerr << "cannot map weights: " << path << std::endl;
+				std::exit(-1);
+			}
+			return;
+		}
 		std::ifstream in(path, std::ios::in | std::ios::binary);
 		if(!in.is_open()) std::exit(-1);
-
-		uint32_t size;
-		in.read(reinterpret_cast<char*>(&size),sizeof(size));
-		net.resize(size);
-		for (weight& w : net) in >> w;	
+		in >> net;
+		if(!in) std::exit(-1);
 		in.close();
 	}
 	virtual void save_weights(const std:: string& path){
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
-		if(!out.is_open()) std::exit(-1);
-		uint32_t size;
-		out.write(reinterpret_cast<char*>(&size),sizeof(size));
-		for (weight& w : net) out << w;
-		out.close();			
+		if(!(pack ? pack->save(path, net) : net.save(path))) std::exit(-1);
 	}
 	/*
 	virtual action_op take_action2(const board& before) {
@@ -244,23 +526,61 @@ protected:
                 return output;
         }*/
 	virtual action_op take_action2(const board& before){
-		int rewards[] = {0,0,0,0};
+		action_op output;
+		output.op = choose(before);
+		output.s = action::slide(output.op);
+		return output;
+	}
+public:
+	/**
+	 * the slide chosen for 'before', i.e., the non-virtual entry of take_action2 for the compiled play loop
+	 */
+	int choose(const board& before){
+		if (reference) return take_reference(before).op;
+		board::reward rewards[4];
 		float a_value[] = {0.0,0.0,0.0,0.0};
+		board after[4];
+		unsigned legal = before.expand(after, rewards);
+		if (learning()){
+			// keep the features of the afterstates, so that the chosen one is never extracted again (see chosen)
+			for (unsigned rest = legal; rest; rest &= rest - 1){
+				int op = __builtin_ctz(rest);
+				extract(after[op], candidates[op]);
+				a_value[op] = sum(candidates[op]);
+			}
+		}else{
+			evaluate(after, legal, a_value);
+		}
+		int index = best(rewards, a_value, legal);
+		chosen_op = learning() ? index : -1;
+		if (index != -1) chosen_after = after[index];
+		if (online()){
+			if (index != -1){
+				follow(candidates[index], rewards[index], a_value[index]);
+			}else{
+				follow();
+			}
+		}
+		return index != -1 ? index : 0;
+	}
+	/**
+	 * the features of 'after' if it is the afterstate last chosen by choose(), or nullptr if they were not kept
+	 */
+	const features* chosen(const board& after) const{
+		return chosen_op != -1 && chosen_after == after ? &candidates[chosen_op] : nullptr;
+	}
+	/**
+	 * the slide to the best of the legal afterstates, by reward + value, or -1 if no slide is legal
+	 * the totals are compared as integers, and the first of equal totals is chosen
+	 */
+	static int best(const board::reward (&rewards)[4], const float (&a_value)[4], unsigned legal){
 		int max = 0;
-		int index = 0;
-		bool first = true;
-		action_op output;
+		int index = -1;
 		for(int i = 0 ;i <4;i++){
-			board tmp = board(before);
-			board::reward reward = tmp.slide(opcode[i]);
-			
-			rewards[i] = reward;
-			a_value[i] = sum(tmp.features());
-			if(reward!=-1){
-				if(first){
+			if(legal & (1u << i)){
+				if(index == -1){
 					max = rewards[i]+a_value[i];
 					index = i;
-					first = false;
 				}else{
 					if(max < rewards[i]+a_value[i]){
 						max = rewards[i]+a_value[i];
@@ -269,12 +589,37 @@ protected:
 				}
 			}
 		}
-		output.s = action::slide(opcode[index]);
-		output.op = opcode[index];
-		return output;
+		return index;
+	}
+	/**
+	 * fetch the weights of the features into the cache, ahead of sum()
+	 */
+	void prefetch(const features& f) const{
+		if (pack) pack->prefetch(f);
+		else if (!quant) net.prefetch(f);
+	}
+protected:
+	/**
+	 * online TD(0): once the next afterstate is chosen, update the last one toward 'reward' + V(next)
+	 * 'value' is V(next) as just estimated by the policy, with no update in between, so only V(last) is looked up again,
+	 * since the previous update may have changed it; the update is then exactly the one update_weights would make here
+	 */
+	void follow(const features& next, board::reward reward, float value){
+		PROFILE_SCOPE(update);
+		if (pending) learn(last_after, reward + value - sum(last_after));
+		last_after = next;
+		pending = true;
+	}
+	/**
+	 * online TD(0) at the end of an episode, where the last afterstate is worth 0
+	 */
+	void follow(){
+		PROFILE_SCOPE(update);
+		if (pending) learn(last_after, 0 - sum(last_after));
+		pending = false;
 	}
 public:
-	void update_weights(std::vector<std::vector<int>> state_index, std::vector<int> rewards, std::vector<std::vector<int>> after_state_index){
+	void update_weights(const std::vector<features>& state_index, const std::vector<int>& rewards, const std::vector<features>& after_state_index){
 		/*float delta = alpha * (0 - sum(state_index[state_index.size()-1]));
 		for (int j = 0 ; j<state_index[state_index.size()-1].size() ; j++){
 			net[j][state_index[state_index.size()-1][j]] += delta;
@@ -287,29 +632,130 @@ public:
 			}
 		}
 		*/
-		float delta = 0;
-		for (int i = 0 ;i<state_index.size();i++){
+		update_weights(state_index.data(), after_state_index.data(), rewards.data(), state_index.size());
+	}
+	/**
+	 * update the weights along the afterstates of an episode, where afterstate (i + 1) follows afterstate (i) with rewards[i],
+	 * i.e., update_weights with the states and the afterstates taken from the same buffer
+	 */
+	void update_weights(const std::vector<features>& path, const std::vector<int>& rewards){
+		if (path.size()) update_weights(path.data(), path.data() + 1, rewards.data(), path.size() - 1);
+	}
+	void update_weights(const features* state_index, const features* after_state_index, const int* rewards, size_t n){
+		if (frozen) return;
+		PROFILE_SCOPE(update);
+		if (lambda > 0){
+			// G(i) = r(i) + (1 - lambda) V(s(i + 1)) + lambda G(i + 1), and G = 0 at the terminal state
+			float target = 0;
+			for (size_t i = n; i-- > 0; ){
+				if(rewards[i] != -1){
+					target = rewards[i] + (1 - lambda) * sum(after_state_index[i]) + lambda * target;
+				}
+				else{
+					target = 0;
+				}
+				learn(state_index[i], target - sum(state_index[i]));
+			}
+			return;
+		}
+		for (size_t i = 0 ;i<n;i++){
 			if(rewards[i] != -1){
-				delta = alpha*(rewards[i] + sum(after_state_index[i]) - sum(state_index[i]));
+				learn(state_index[i], rewards[i] + sum(after_state_index[i]) - sum(state_index[i]));
 			}
 			else{
-				delta = alpha*(0 - sum(state_index[i]));
-			}
-			for(int j = 0;j<state_index[i].size();j++){
-				net[j][state_index[i][j]] += delta;
+				learn(state_index[i], 0 - sum(state_index[i]));
 			}
 		}
 	}
-	float sum(std::vector<int> weight_index){
-		float advantage_value = 0;
-		for(int i = 0 ;i<weight_index.size();i++){
-			advantage_value += net[i][weight_index[i]];
+	/**
+	 * move the value of the features toward the target by 'error'
+	 */
+	void learn(const features& f, float error){
+		if (tally) tally->update(f);
+		if (net.coherent()) net.update(f, alpha, error);
+		else net.update(f, alpha * error);
+	}
+	features extract(const board& b) const{
+		PROFILE_SCOPE(extract);
+		return net.extract(b);
+	}
+	void extract(const board& b, features& f) const{
+		PROFILE_SCOPE(extract);
+		net.extract(b, f);
+	}
+	float sum(const features& weight_index) const{
+		PROFILE_SCOPE(evaluate);
+		if (tally) tally->access(weight_index);
+		return quant ? quant->estimate(weight_index) : pack ? pack->estimate(weight_index) : net.estimate(weight_index);
+	}
+	/**
+	 * the value of a board, i.e., sum(extract(b)), fused into one kernel unless quantized, compact, or counted
+	 */
+	float evaluate(const board& b) const{
+		if (quant || pack || tally) return sum(extract(b));
+		PROFILE_SCOPE(evaluate);
+		return net.evaluate(b);
+	}
+	/**
+	 * the values of the legal afterstates of a state in one pass (see board::expand), the others are left unchanged
+	 */
+	void evaluate(const board (&after)[4], unsigned legal, float (&value)[4]) const{
+		if (quant || pack || tally){
+			for (int i = 0; i < 4; i++) if (legal & (1u << i)) value[i] = sum(extract(after[i]));
+			return;
+		}
+		PROFILE_SCOPE(evaluate);
+		net.evaluate(after, legal, value);
+	}
+protected:
+	/**
+	 * play with the float network, while measuring how the quantized network diverges on the same afterstates
+	 */
+	action_op take_reference(const board& before){
+		int exact = -1, approx = -1;
+		float exact_max = 0, approx_max = 0;
+		board after[4];
+		board::reward reward[4];
+		for (unsigned legal = before.expand(after, reward); legal; legal &= legal - 1){
+			int op = __builtin_ctz(legal);
+			features f = extract(after[op]);
+			float value = net.estimate(f), guess = quant->estimate(f);
+			ref.record(value, guess);
+			if (exact == -1 || reward[op] + value > exact_max) exact = op, exact_max = reward[op] + value;
+			if (approx == -1 || reward[op] + guess > approx_max) approx = op, approx_max = reward[op] + guess;
 		}
-		return advantage_value;
+		if (exact != -1) ref.choose(exact, approx);
+		action_op output;
+		output.op = exact != -1 ? exact : opcode[0];
+		output.s = action::slide(output.op);
+		return output;
 	}
+	/**
+	 * the reference episodes left to play
+	 */
+	int references() const { return reference; }
+	void report(){
+		std::cout << "quantize: " << quant->name() << ", ";
+		std::cout << (net.size() * sizeof(float) >> 10) << "KB -> " << (quant->bytes() >> 10) << "KB, ";
+		std::cout << ref << std::endl;
+	}
+
 protected:
-	std::vector<weight> net;
+	std::shared_ptr<network> shared;
+	network& net;
+	std::shared_ptr<quantized> quant;
+	std::shared_ptr<compacted> pack;
+	std::shared_ptr<census> tally;
 private:
-	int num_feature;
 	float alpha;
+	float lambda;
+	bool frozen;
+	bool learn_online;
+	bool pending; // whether 'last_after' is waiting for its online update
+	features last_after;
+	features candidates[4]; // the features of the afterstates of the last choose(), when learning
+	board chosen_after;
+	int chosen_op = -1;
+	int reference;
+	divergence ref;
 };
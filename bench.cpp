@@ -0,0 +1,320 @@
+/**
+ * Microbenchmarks for Threes
+ * use 'make bench' to compile and run, the results are printed as JSON
+ * after the kernel, and whether the network is specialised (see fixed.h), e.g., not with 'fixed=0'
+ *
+ * every benchmark runs over a fixed corpus of positions, collected from games of a random player
+ * against rndenv with fixed seeds, so that the numbers are comparable between builds
+ *
+ * options:
+ *  --play=ARGS      the arguments of the weight_agent, e.g., "tuples=4x6 load=weights.bin simd=scalar" (default "init")
+ *  --corpus=N       the number of positions in the corpus (default 4096)
+ *  --rounds=N       the passes over the corpus for each benchmark (default 64)
+ *  --episodes=N     the episodes played for the full-episode benchmark (default 200)
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+
+/**
+ * a position where the player is to move, with the afterstate and reward of a legal move (op)
+ */
+struct position {
+	board before;
+	board after;
+	int op;
+	board::reward reward;
+};
+
+/**
+ * collect 'size' positions from games of a random player against rndenv, both seeded by 1
+ */
+std::vector<position> make_corpus(size_t size) {
+	std::vector<position> corpus;
+	player play("seed=1");
+	rndenv evil("seed=1");
+	while (corpus.size() < size) {
+		episode game;
+		play.open_episode();
+		evil.open_episode();
+		int last_slide = -1;
+		while (corpus.size() < size) {
+			agent& who = game.take_turns(play, evil);
+			action move;
+			if (who.role() == "player") {
+				action_op out = who.take_action2(game.state());
+				if (out.op == -1) break;
+				position p;
+				p.before = p.after = game.state();
+				p.op = out.op;
+				p.reward = p.after.slide(out.op);
+				corpus.push_back(p);
+				move = out.s;
+				last_slide = out.op;
+			} else {
+				move = who.take_action(game.state(), last_slide);
+			}
+			if (!game.apply_action(move).legal_action) break;
+		}
+	}
+	return corpus;
+}
+
+/**
+ * timer of a single benchmark, printed as a JSON object
+ */
+class bench {
+public:
+	bench(const std::string& name) : name(name), ops(0), start(clock::now()) {}
+	void stop(size_t count) {
+		ops = count;
+		elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+	}
+	int64_t elapsed_ns() const { return elapsed; }
+	friend std::ostream& operator <<(std::ostream& out, const bench& b) {
+		double ns = b.ops ? double(b.elapsed) / b.ops : 0;
+		out << "{\"name\": \"" << b.name << "\", \"ops\": " << b.ops << ", \"ns\": " << b.elapsed;
+		out << ", \"ns_per_op\": " << ns << ", \"ops_per_sec\": " << (ns ? 1e9 / ns : 0) << "}";
+		return out;
+	}
+private:
+	typedef std::chrono::steady_clock clock;
+	std::string name;
+	size_t ops;
+	int64_t elapsed;
+	clock::time_point start;
+};
+
+/**
+ * keeps the benchmarked results alive
+ */
+static volatile uint64_t sink;
+
+int main(int argc, const char* argv[]) {
+	std::string play_args = "init";
+	size_t size = 4096, rounds = 64, episodes = 200;
+	for (int i = 1; i < argc; i++) {
+		std::string para(argv[i]);
+		if (para.find("--play=") == 0) {
+			play_args = para.substr(para.find("=") + 1);
+		} else if (para.find("--corpus=") == 0) {
+			size = std::max(std::stoull(para.substr(para.find("=") + 1)), 2ull);
+		} else if (para.find("--rounds=") == 0) {
+			rounds = std::max(std::stoull(para.substr(para.find("=") + 1)), 1ull);
+		} else if (para.find("--episodes=") == 0) {
+			episodes = std::max(std::stoull(para.substr(para.find("=") + 1)), 1ull);
+		}
+	}
+
+	std::vector<position> corpus = make_corpus(size);
+	weight_agent play(play_args);
+	std::vector<bench> results;
+
+	const char* slides[] = { "slide_up", "slide_right", "slide_down", "slide_left" };
+	for (int op = 0; op < 4; op++) {
+		bench b(slides[op]);
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const position& p : corpus) {
+				board tmp = p.before;
+				acc += tmp.slide(op) + tmp.raw();
+			}
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	{
+		bench b("expand");
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const position& p : corpus) {
+				board after[4];
+				board::reward reward[4];
+				acc += p.before.expand(after, reward) + after[p.op].raw() + reward[p.op];
+			}
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	{
+		bench b("can_move");
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const position& p : corpus) acc += p.after.can_move();
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	{
+		bench b("features");
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const position& p : corpus) acc += play.extract(p.after)[0];
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	std::vector<features> index;
+	index.reserve(corpus.size());
+	for (const position& p : corpus) index.push_back(play.extract(p.after));
+	{
+		bench b("sum");
+		float acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const features& f : index) acc += play.sum(f);
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = uint64_t(acc);
+	}
+
+	{
+		bench b("evaluate");
+		float acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const position& p : corpus) acc += play.evaluate(p.after);
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = uint64_t(acc);
+	}
+
+	{
+		bench b("take_action2");
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const position& p : corpus) acc += static_cast<agent&>(play).take_action2(p.before).op;
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	{
+		// the corpus as one long trajectory, each afterstate followed by the next one
+		std::vector<features> after_index(index.begin() + 1, index.end());
+		std::vector<features> state_index(index.begin(), index.end() - 1);
+		std::vector<int> rewards;
+		for (size_t i = 1; i < corpus.size(); i++) rewards.push_back(corpus[i].reward);
+		bench b("update_weights");
+		for (size_t r = 0; r < rounds; r++) play.update_weights(state_index, rewards, after_index);
+		b.stop(rounds * state_index.size());
+		results.push_back(b);
+	}
+
+	{
+		rndenv evil("seed=1");
+		evil.open_episode();
+		bench b("rndenv::take_action");
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const position& p : corpus) acc += unsigned(evil.take_action(p.after, p.op));
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	{
+		bench b("rndenv::outcomes");
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (const position& p : corpus) {
+				rndenv::outcome out[rndenv::max_outcomes];
+				board after(p.after.raw(), rndenv::pack(rndenv::full_bag, p.op));
+				size_t n = rndenv::outcomes(after, out);
+				acc += n + out[n - 1].move.code;
+			}
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	{
+		std::vector<action> moves;
+		for (const position& p : corpus) moves.push_back(action::slide(p.op));
+		bench b("action::apply");
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < corpus.size(); i++) {
+				board tmp = corpus[i].before;
+				acc += moves[i].apply(tmp) + tmp.raw();
+			}
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	{
+		std::vector<action_code> codes;
+		for (const position& p : corpus) codes.push_back(action_code::slide(p.op));
+		bench b("action_code::apply");
+		uint64_t acc = 0;
+		for (size_t r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < corpus.size(); i++) {
+				board tmp = corpus[i].before;
+				acc += codes[i].apply(tmp) + tmp.raw();
+			}
+		}
+		b.stop(rounds * corpus.size());
+		results.push_back(b);
+		sink = acc;
+	}
+
+	// full episodes of the greedy player against rndenv, in the compiled play loop of training,
+	// where a move is either a slide or a placement
+	rndenv evil("seed=1");
+	size_t moves = 0;
+	bench b("episode");
+	for (size_t e = 0; e < episodes; e++) {
+		episode game;
+		play.open_episode();
+		evil.open_episode();
+		int last_slide = -1;
+		while (true) {
+			action_code move;
+			if (game.player_turn()) {
+				last_slide = play.choose(game.state());
+				move = action_code::slide(last_slide);
+			} else {
+				move = evil.place(game.state(), last_slide);
+			}
+			if (!game.apply_action(move).legal_action) break;
+			moves++;
+		}
+		play.close_episode();
+		evil.close_episode();
+	}
+	b.stop(episodes);
+
+	std::cout << "{" << std::endl;
+	std::cout << "\t\"play\": \"" << play_args << "\", \"corpus\": " << corpus.size() << ", \"rounds\": " << rounds;
+	std::cout << ", \"kernel\": \"" << network::name(network::kernel()) << "\"";
+	std::cout << ", \"specialised\": " << (play.specialised() ? "true" : "false") << "," << std::endl;
+	std::cout << "\t\"benchmarks\": [" << std::endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		std::cout << "\t\t" << results[i] << "," << std::endl;
+	}
+	std::cout << "\t\t" << b << std::endl;
+	std::cout << "\t]," << std::endl;
+	std::cout << "\t\"episode\": {\"episodes\": " << episodes << ", \"moves\": " << moves;
+	std::cout << ", \"moves_per_sec\": " << (moves * 1e9 / std::max<double>(1, b.elapsed_ns())) << "}" << std::endl;
+	std::cout << "}" << std::endl;
+	return 0;
+}
@@ -3,8 +3,10 @@
 #include <iostream>
 #include <iomanip>
 #include <vector>
+#include <cstdint>
+#include "profile.h"
 /**
- * array-based board for 2048
+ * bitboard for threes
  *
  * index (1-d form):
  *  (0)  (1)  (2)  (3)
@@ -12,34 +14,55 @@
  *  (8)  (9) (10) (11)
  * (12) (13) (14) (15)
  *
+ * all 16 cells are packed into a single 64-bit word, 4 bits (the tile index) per cell,
+ * where cell (i) is stored in bits [4i, 4i + 4), i.e., row (r) is the 16-bit word at bit 16r
  */
 class board {
-	static const std::vector<std::vector<int>> feature_indices;
 public:
 	typedef uint32_t cell;
 	typedef std::array<cell, 4> row;
 	typedef std::array<row, 4> grid;
 	typedef uint64_t data;
 	typedef int reward;
-	int * index_to_tile;
-	int * index_to_score;
+	static const int index_to_tile[16];
+	static const int index_to_score[16];
+
+	/**
+	 * writable reference to a packed cell, returned by the non-const operator()
+	 */
+	class cell_ref {
+	public:
+		cell_ref(data& raw, unsigned i) : raw(raw), shift(i << 2) {}
+		operator cell() const { return (raw >> shift) & 0x0f; }
+		cell_ref& operator =(cell t) {
+			raw = (raw & ~(data(0x0f) << shift)) | (data(t & 0x0f) << shift);
+			return *this;
+		}
+		cell_ref& operator =(const cell_ref& r) { return operator =(cell(r)); }
+	private:
+		data& raw;
+		unsigned shift;
+	};
+
 public:
-	board() : tile(), attr(0){ 
-		build_table();
-	}
-	board(const grid& b, data v = 0) : tile(b), attr(v){
-		build_table();
+	board() : tile(0), attr(0){}
+	board(const grid& b, data v = 0) : tile(0), attr(v){
+		for (int i = 0; i < 16; i++) operator()(i) = b[i / 4][i % 4];
 	}
+	explicit board(data raw, data v = 0) : tile(raw), attr(v){}
 	board(const board& b) = default;
 	board& operator =(const board& b) = default;
 
-	operator grid&() { return tile; }
-	operator const grid&() const { return tile; }
-	row& operator [](unsigned i) { return tile[i]; }
-	const row& operator [](unsigned i) const { return tile[i]; }
-	cell& operator ()(unsigned i) { return tile[i / 4][i % 4]; }
-	const cell& operator ()(unsigned i) const { return tile[i / 4][i % 4]; }
+	operator grid() const {
+		grid g;
+		for (int i = 0; i < 16; i++) g[i / 4][i % 4] = operator()(i);
+		return g;
+	}
+	row operator [](unsigned i) const { return operator grid()[i]; }
+	cell_ref operator ()(unsigned i) { return cell_ref(tile, i); }
+	cell operator ()(unsigned i) const { return (tile >> (i << 2)) & 0x0f; }
 
+	data raw() const { return tile; }
 	data info() const { return attr; }
 	data info(data dat) { data old = attr; attr = dat; return old; }
 
@@ -52,33 +75,25 @@ public:
 	bool operator >=(const board& b) const { return !(*this < b); }
 
 public:
-	
-	void build_table(){
-		index_to_tile = new int [16];
-		index_to_score = new int [16];
-		for(int i = 0;i<4;i++)
-		{
-			index_to_tile[i] = i;
-			index_to_score[i] = 0;
-		}
-		index_to_score[3] = 3;
-		for(int i = 4;i<16;i++){
-			index_to_tile[i] = 2 * index_to_tile[i - 1];
-			index_to_score[i] = 3 * index_to_score[i - 1];
-		}
+
+	/**
+	 * the largest tile index on the board
+	 */
+	cell max_tile() const {
+		cell top = 0;
+		for (data t = tile; t; t >>= 4) top = std::max(top, cell(t & 0x0f));
+		return top;
 	}
-	std::vector<int> features(){
-		std::vector<int> indices;
-		for(int i = 0 ;i<feature_indices.size();i++){
-			int index = 0;
-			for(int j = 0;j<feature_indices[i].size();j++){
-				index *= 16;
-				index += (*this)(feature_indices[i][j]);
-				
-			}
-			indices.push_back(index);
-		}
-		return indices;
+	/**
+	 * the empty cells as a 16-bit mask, where bit (i) is set if cell (i) is empty
+	 */
+	unsigned empty_cells() const {
+		data t = tile | (tile >> 1);
+		t = ~(t | (t >> 2)) & 0x1111111111111111ull; // bit 4i is set if cell (i) is empty
+		t = (t | (t >> 3)) & 0x0303030303030303ull;
+		t = (t | (t >> 6)) & 0x000f000f000f000full;
+		t = (t | (t >> 12)) & 0x000000ff000000ffull;
+		return unsigned((t | (t >> 24)) & 0xffff);
 	}
 	/**
 	 * place a tile (index value) to the specific position (1-d form index)
@@ -96,6 +111,7 @@ public:
 	 * return the reward of the action, or -1 if the action is illegal
 	 */
 	reward slide(unsigned opcode) {
+		PROFILE_SCOPE(slide);
 		switch (opcode & 0b11) {
 		case 0: return slide_up();
 		case 1: return slide_right();
@@ -105,77 +121,117 @@ public:
 		}
 	}
 
+	/**
+	 * all four afterstates in one pass, indexed by opcode (up, right, down, left)
+	 * left and right share the row lookups of the board, and up and down share those of its transpose
+	 * the reward of an illegal slide is -1, and its afterstate is the board itself
+	 * return the legal moves as a mask, where bit (op) is set if slide (op) is legal
+	 */
+	unsigned expand(board (&after)[4], reward (&score)[4]) const {
+		PROFILE_SCOPE(slide);
+		data t = transposed(tile);
+		data l = 0, r = 0, u = 0, d = 0;
+		reward ls = 0, rs = 0, us = 0, ds = 0;
+		for (int i = 0; i < 4; i++) {
+			const lookup::entry& h = moves.row[uint16_t(tile >> (i << 4))];
+			const lookup::entry& v = moves.row[uint16_t(t >> (i << 4))];
+			l |= data(h.left) << (i << 4);
+			r |= data(h.right) << (i << 4);
+			u |= data(v.left) << (i << 4);
+			d |= data(v.right) << (i << 4);
+			ls += h.lscore;
+			rs += h.rscore;
+			us += v.lscore;
+			ds += v.rscore;
+		}
+		unsigned legal = (u != t) | ((r != tile) << 1) | ((d != t) << 2) | ((l != tile) << 3);
+		after[0] = after[1] = after[2] = after[3] = *this;
+		after[0].tile = transposed(u);
+		after[1].tile = r;
+		after[2].tile = transposed(d);
+		after[3].tile = l;
+		score[0] = (legal & 1) ? us : -1;
+		score[1] = (legal & 2) ? rs : -1;
+		score[2] = (legal & 4) ? ds : -1;
+		score[3] = (legal & 8) ? ls : -1;
+		return legal;
+	}
+	/**
+	 * the legal moves as a mask (see expand), without building the afterstates
+	 */
+	unsigned legal_moves() const {
+		data t = transposed(tile);
+		data l = 0, r = 0, u = 0, d = 0;
+		for (int i = 0; i < 4; i++) {
+			const lookup::entry& h = moves.row[uint16_t(tile >> (i << 4))];
+			const lookup::entry& v = moves.row[uint16_t(t >> (i << 4))];
+			l |= data(h.left) << (i << 4);
+			r |= data(h.right) << (i << 4);
+			u |= data(v.left) << (i << 4);
+			d |= data(v.right) << (i << 4);
+		}
+		return (u != t) | ((r != tile) << 1) | ((d != t) << 2) | ((l != tile) << 3);
+	}
+	bool can_move() const { return legal_moves() != 0; }
+	bool is_terminal() const { return !can_move(); }
+
 	reward slide_left() {
-		board prev = *this;
+		data prev = tile, next = 0;
 		reward score = 0;
 		for (int r = 0; r < 4; r++) {
-			std::vector<int> append_row(tile[r].begin(), tile[r].end());
-			append_row.push_back(0);
-			bool merge = false;
-			int col = 0;
-			while(append_row[0] && not merge){
-				if (append_row[0] == append_row[1] && append_row[0] > 2){
-					append_row.erase(append_row.begin());
-					append_row[0] += 1;
-					merge = true;
-					score += index_to_score[append_row[0]];
-				}else if(append_row[0] > 0 && append_row[1] > 0 && append_row [0] + append_row[1] == 3){
-					append_row.erase(append_row.begin());
-					append_row[0] = 3;
-					score += index_to_score[append_row[0]];
-					merge = true;
-				}
-				tile[r][col] = append_row[0];
-				col += 1;
-				if(! merge){
-					append_row.erase(append_row.begin());
-				}
-			}
-			for(int i = 0; i< append_row.size() - 1 ;i++){
-				tile[r][col+i] = append_row[i + 1];
-			}
+			const lookup::entry& e = moves.row[uint16_t(prev >> (r << 4))];
+			next |= data(e.left) << (r << 4);
+			score += e.lscore;
 		}
-		return (*this != prev) ? score : -1;
+		tile = next;
+		return (tile != prev) ? score : -1;
 	}
 	reward slide_right() {
-		reflect_horizontal();
-		reward score = slide_left();
-		reflect_horizontal();
-		return score;
+		data prev = tile, next = 0;
+		reward score = 0;
+		for (int r = 0; r < 4; r++) {
+			const lookup::entry& e = moves.row[uint16_t(prev >> (r << 4))];
+			next |= data(e.right) << (r << 4);
+			score += e.rscore;
+		}
+		tile = next;
+		return (tile != prev) ? score : -1;
 	}
 	reward slide_up() {
-		rotate_right();
-		reward score = slide_right();
-		rotate_left();
+		transpose();
+		reward score = slide_left();
+		transpose();
 		return score;
 	}
 	reward slide_down() {
-		rotate_right();
-		reward score = slide_left();
-		rotate_left();
+		transpose();
+		reward score = slide_right();
+		transpose();
 		return score;
 	}
 
-	void transpose() {
-		for (int r = 0; r < 4; r++) {
-			for (int c = r + 1; c < 4; c++) {
-				std::swap(tile[r][c], tile[c][r]);
-			}
-		}
+	void transpose() { tile = transposed(tile); }
+	static data transposed(data t) {
+		data a = (t & 0xf0f00f0ff0f00f0full)
+		       | ((t & 0x0000f0f00000f0f0ull) << 12)
+		       | ((t & 0x0f0f00000f0f0000ull) >> 12);
+		return (a & 0xff00ff0000ff00ffull)
+		     | ((a & 0x00ff00ff00000000ull) >> 24)
+		     | ((a & 0x00000000ff00ff00ull) << 24);
 	}
 
 	void reflect_horizontal() {
-		for (int r = 0; r < 4; r++) {
-			std::swap(tile[r][0], tile[r][3]);
-			std::swap(tile[r][1], tile[r][2]);
-		}
+		tile = ((tile & 0x000f000f000f000full) << 12)
+		     | ((tile & 0x00f000f000f000f0ull) << 4)
+		     | ((tile & 0x0f000f000f000f00ull) >> 4)
+		     | ((tile & 0xf000f000f000f000ull) >> 12);
 	}
 
 	void reflect_vertical() {
-		for (int c = 0; c < 4; c++) {
-			std::swap(tile[0][c], tile[3][c]);
-			std::swap(tile[1][c], tile[2][c]);
-		}
+		tile = ((tile & 0x000000000000ffffull) << 48)
+		     | ((tile & 0x00000000ffff0000ull) << 16)
+		     | ((tile & 0x0000ffff00000000ull) >> 16)
+		     | ((tile & 0xffff000000000000ull) >> 48);
 	}
 
 	/**
@@ -194,21 +250,77 @@ public:
 	void rotate_right() { transpose(); reflect_horizontal(); } // clockwise
 	void rotate_left() { transpose(); reflect_vertical(); } // counterclockwise
 	void reverse() { reflect_horizontal(); reflect_vertical(); }
-	
+
 public:
 	friend std::ostream& operator <<(std::ostream& out, const board& b) {
 		out << "+------------------------+" << std::endl;
-		for (auto& row : b.tile) {
+		for (int r = 0; r < 4; r++) {
 			out << "|" << std::dec;
-			for (auto t : row) out << std::setw(6) << b.index_to_tile[t];
+			for (int c = 0; c < 4; c++) out << std::setw(6) << b.index_to_tile[b(r * 4 + c)];
 			out << "|" << std::endl;
 		}
 		out << "+------------------------+" << std::endl;
 		return out;
 	}
-	
+
 private:
-	grid tile;
+	/**
+	 * precomputed slides of every possible 16-bit row
+	 * 'left'/'right' hold the slid row, 'lscore'/'rscore' hold the merge score of that slide,
+	 * all in one entry so that both directions of a row are a single lookup
+	 * up and down reuse the same tables on the transposed board
+	 */
+	struct lookup {
+		struct entry {
+			uint16_t left, right;
+			reward lscore, rscore;
+		};
+		entry row[65536];
+
+		lookup() {
+			for (unsigned line = 0; line < 65536; line++) {
+				cell t[4] = { line & 0x0f, (line >> 4) & 0x0f, (line >> 8) & 0x0f, (line >> 12) & 0x0f };
+				cell v[4] = { t[3], t[2], t[1], t[0] };
+				entry& e = row[line];
+				e.lscore = slide_row(t);
+				e.rscore = slide_row(v);
+				e.left = t[0] | (t[1] << 4) | (t[2] << 8) | (t[3] << 12);
+				e.right = v[3] | (v[2] << 4) | (v[1] << 8) | (v[0] << 12);
+			}
+		}
+
+		/**
+		 * slide a single row toward index 0, return the merge score
+		 * the first empty cell or the first merge (1 + 2, or two equal tiles >= 3) shifts the rest by one
+		 * tiles are capped at index 15 so that the result still fits in 4 bits
+		 */
+		static reward slide_row(cell t[4]) {
+			for (int c = 0; c < 3; c++) {
+				cell a = t[c], b = t[c + 1];
+				reward score = 0;
+				if (a == 0) {
+					score = 0;
+				} else if (a == b && a > 2 && a < 15) {
+					t[c + 1] = a + 1;
+					score = index_to_score[a + 1];
+				} else if (b && a + b == 3) {
+					t[c + 1] = 3;
+					score = index_to_score[3];
+				} else {
+					continue;
+				}
+				for (int i = c; i < 3; i++) t[i] = t[i + 1];
+				t[3] = 0;
+				return score;
+			}
+			return 0;
+		}
+	};
+	static const lookup moves;
+
+	data tile;
 	data attr;
 };
-const std::vector<std::vector<int>> board::feature_indices({{0,1,2,3},{4,5,6,7},{8,9,10,11},{12,13,14,15},{0,4,8,12},{1,5,9,13},{2,6,10,14},{3,7,11,15}});
+const int board::index_to_tile[16] = { 0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144, 12288 };
+const int board::index_to_score[16] = { 0, 0, 0, 3, 9, 27, 81, 243, 729, 2187, 6561, 19683, 59049, 177147, 531441, 1594323 };
+const board::lookup board::moves;
@@ -0,0 +1,136 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include "network.h"
+
+/**
+ * access census of the weight tables of a network, i.e., how often each weight is looked up and updated
+ *
+ * the counters are kept per weight (saturating at 2^32 - 1), and are updated without locking,
+ * so that they are approximate when several threads share a census, just like the weights under Hogwild
+ *
+ * the report of a table covers its entries, the visited (looked up) and updated ones, and how many lines
+ * of 16 weights (one cache line, see network) hold any visited weight, i.e., the working set of the table;
+ * its heatmap is the share of visited entries by the tiles of the first two cells of the tuple
+ */
+class census {
+public:
+	census(const network& net) : net(net), reads(net.size(), 0), writes(net.size(), 0) {}
+
+	void access(const features& f) {
+		for (uint32_t offset : f) reads[offset] += (reads[offset] != UINT32_MAX);
+	}
+	void update(const features& f) {
+		for (uint32_t offset : f) writes[offset] += (writes[offset] != UINT32_MAX);
+	}
+
+	/**
+	 * the totals of a table
+	 */
+	struct table {
+		size_t entries = 0, visited = 0, updated = 0, lines = 0, hot = 0;
+		uint64_t accesses = 0, updates = 0;
+		uint64_t histogram[33] = { 0 }; // entries by accesses: 0, 1, 2-3, 4-7, ...
+		size_t heat[16][16] = { { 0 } }; // visited entries by the tiles of the first two cells
+	};
+	table summary(size_t t) const {
+		table s;
+		size_t begin = net.table_offset(t), size = net.table_size(t);
+		unsigned cells = __builtin_ctzll(size) / 4;
+		s.entries = size;
+		for (size_t i = 0; i < size; i += 16) {
+			bool hot = false;
+			for (size_t j = i; j < i + 16 && j < size; j++) {
+				uint32_t r = reads[begin + j], w = writes[begin + j];
+				s.accesses += r;
+				s.updates += w;
+				s.visited += (r != 0);
+				s.updated += (w != 0);
+				s.histogram[r ? 32 - __builtin_clz(r) : 0]++;
+				if (r && cells > 1) s.heat[j >> (4 * cells - 4)][(j >> (4 * cells - 8)) & 0x0f]++;
+				else if (r) s.heat[j][0]++;
+				hot |= (r != 0);
+			}
+			s.lines++;
+			s.hot += hot;
+		}
+		return s;
+	}
+
+	/**
+	 * print one line per table, and the share of the network in its working set
+	 */
+	void show(std::ostream& out) const {
+		size_t entries = 0, visited = 0, lines = 0, hot = 0;
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed << std::setprecision(1);
+		for (size_t t = 0; t < net.tables(); t++) {
+			table s = summary(t);
+			out << "census: table " << t << " (" << tuple(t) << " @ stage " << t / shapes() << "), " << s.entries << " entries, ";
+			out << (s.visited * 100.0 / s.entries) << "% visited, " << (s.updated * 100.0 / s.entries) << "% updated, ";
+			out << (s.hot * 100.0 / s.lines) << "% lines hot, " << s.accesses << " accesses, " << s.updates << " updates" << std::endl;
+			entries += s.entries, visited += s.visited, lines += s.lines, hot += s.hot;
+		}
+		out << "census: " << visited << " of " << entries << " weights visited (" << (visited * 100.0 / std::max<size_t>(entries, 1)) << "%), ";
+		out << "working set " << (lines * 64 >> 10) << "KB -> " << (hot * 64 >> 10) << "KB in lines of 16 weights" << std::endl;
+		out.copyfmt(ff);
+	}
+
+	/**
+	 * write the report to 'path', as CSV if it ends with ".csv" (one row per table and pair of first tiles),
+	 * or as JSON otherwise (one object per table, with its histogram and heatmap)
+	 */
+	bool dump(const std::string& path) const {
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) return false;
+		bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+		if (csv) out << "table,tuple,stage,first,second,visited" << std::endl;
+		else out << "{" << std::endl << "\t\"tables\": [" << std::endl;
+		for (size_t t = 0; t < net.tables(); t++) {
+			table s = summary(t);
+			if (csv) {
+				for (size_t a = 0; a < 16; a++) {
+					for (size_t b = 0; b < 16; b++) {
+						if (!s.heat[a][b]) continue;
+						out << t << "," << tuple(t) << "," << t / shapes() << ",";
+						out << board::index_to_tile[a] << "," << board::index_to_tile[b] << "," << s.heat[a][b] << std::endl;
+					}
+				}
+				continue;
+			}
+			out << "\t\t{\"table\": " << t << ", \"tuple\": \"" << tuple(t) << "\", \"stage\": " << t / shapes();
+			out << ", \"entries\": " << s.entries << ", \"visited\": " << s.visited << ", \"updated\": " << s.updated;
+			out << ", \"lines\": " << s.lines << ", \"hot_lines\": " << s.hot;
+			out << ", \"accesses\": " << s.accesses << ", \"updates\": " << s.updates << "," << std::endl;
+			out << "\t\t\t\"histogram\": [";
+			for (size_t i = 0; i < 33; i++) out << (i ? ", " : "") << s.histogram[i];
+			out << "]," << std::endl << "\t\t\t\"heatmap\": [" << std::endl;
+			for (size_t a = 0; a < 16; a++) {
+				out << "\t\t\t\t[";
+				for (size_t b = 0; b < 16; b++) out << (b ? ", " : "") << s.heat[a][b];
+				out << "]" << (a + 1 < 16 ? "," : "") << std::endl;
+			}
+			out << "\t\t\t]}" << (t + 1 < net.tables() ? "," : "") << std::endl;
+		}
+		if (!csv) out << "\t]" << std::endl << "}" << std::endl;
+		return bool(out);
+	}
+
+private:
+	size_t shapes() const { return net.tables() / net.stages(); }
+	std::string tuple(size_t t) const {
+		std::string spec = net.tuples() + ",";
+		for (size_t i = 0; i < t % shapes(); i++) spec.erase(0, spec.find(',') + 1);
+		return spec.substr(0, spec.find(','));
+	}
+
+	const network& net;
+	std::vector<uint32_t> reads;
+	std::vector<uint32_t> writes;
+};
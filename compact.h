@@ -0,0 +1,144 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include "weight.h"
+#include "network.h"
+
+/**
+ * compact copy of a network for evaluation-only runs, without the lines of weights that were never trained
+ *
+ * the tables are split into lines of 16 weights (one cache line, see network), and only the lines with
+ * a nonzero weight are kept; a directory maps every line of the network to its kept line, or to a shared
+ * line of zeros, so that a lookup is two loads and the features of a board are unchanged
+ * since the weights start from zero, a line is dropped only if none of its weights was ever trained
+ * (or their updates cancelled out exactly), so the values of all boards are the same as the network's
+ *
+ * in a file, the compact weights follow a header of the layout (see network::header) with version 3:
+ * the directory (one uint32_t per line, padded to a cache line) and then the kept lines, which are mapped without copying
+ */
+class compacted {
+public:
+	static constexpr uint32_t version = 3;
+
+	compacted(const network& net) : directory(net.size() / 16, 0) {
+		const weight& w = net.weights();
+		size_t kept = 1;
+		for (size_t i = 0; i < directory.size(); i++) {
+			const float* line = w.data() + i * 16;
+			if (std::any_of(line, line + 16, [](float v) { return v != 0; })) directory[i] = kept++;
+		}
+		value = weight(kept * 16);
+		for (size_t i = 0; i < directory.size(); i++) {
+			if (directory[i]) std::copy(w.data() + i * 16, w.data() + i * 16 + 16, value.data() + directory[i] * 16);
+		}
+	}
+
+	/**
+	 * the compact weights of a file in the compact format, whose layout must be the same as 'net'
+	 * with 'verify', the checksum of the kept lines is checked as well (see network::map)
+	 * return nullptr if the file cannot be read
+	 */
+	static std::shared_ptr<compacted> load(const std::string& path, const network& net, bool verify = false) {
+		network::header h;
+		if (!network::probe(path, h) || h.version != version || !net.fits(h) || h.lines == 0) return nullptr;
+		std::shared_ptr<compacted> c(new compacted());
+		c->directory.resize(net.size() / 16);
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		in.seekg(h.offset);
+		in.read(reinterpret_cast<char*>(c->directory.data()), c->directory.size() * sizeof(uint32_t));
+		if (!in) return nullptr;
+		for (uint32_t line : c->directory) if (line >= h.lines) return nullptr;
+		c->value = weight::map(path, h.offset + c->padded(), h.lines * 16, false);
+		if (c->value.size() != h.lines * 16) return nullptr;
+		if (verify && network::checksum(c->value.data(), c->value.size() * sizeof(float)) != h.checksum) return nullptr;
+		return c;
+	}
+	/**
+	 * save in the compact format of 'net', which must be the network this copy was made from
+	 */
+	bool save(const std::string& path, const network& net) const {
+		network::header h = net.layout();
+		h.version = version;
+		h.offset = sizeof(h);
+		h.lines = lines();
+		h.checksum = network::checksum(value.data(), value.size() * sizeof(float));
+		h.self = network::checksum(&h, sizeof(h));
+
+		std::string temp = path + ".tmp";
+		std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		out.write(reinterpret_cast<const char*>(directory.data()), directory.size() * sizeof(uint32_t));
+		out.write(std::string(padded() - directory.size() * sizeof(uint32_t), '\0').data(), padded() - directory.size() * sizeof(uint32_t));
+		out.write(reinterpret_cast<const char*>(value.data()), value.size() * sizeof(float));
+		out.close();
+		return out && std::rename(temp.c_str(), path.c_str()) == 0;
+	}
+
+	/**
+	 * the same sum as network::estimate, feature (i) into lane (i % 8)
+	 */
+	float estimate(const features& f) const {
+#ifdef NETWORK_AVX2
+		if (network::kernel() == network::avx2 && value.size() <= INT32_MAX) return estimate_avx2(f.begin(), f.size());
+#endif
+		float lane[8] = { 0 };
+		for (size_t i = 0; i < f.size(); i++) {
+			uint32_t offset = f[i];
+			lane[i % 8] += value[(size_t(directory[offset >> 4]) << 4) | (offset & 15)];
+		}
+		float sum = 0;
+		for (size_t k = 0; k < 8; k++) sum += lane[k];
+		return sum;
+	}
+	void prefetch(const features& f) const {
+		for (uint32_t offset : f) __builtin_prefetch(&directory[offset >> 4]);
+	}
+
+	/**
+	 * the kept lines (including the line of zeros), of all lines of the network
+	 */
+	size_t lines() const { return value.size() / 16; }
+	size_t total() const { return directory.size(); }
+	size_t bytes() const { return directory.size() * sizeof(uint32_t) + value.size() * sizeof(float); }
+
+private:
+	compacted() {}
+	/**
+	 * the bytes of the directory in a file, so that the kept lines start at a cache line
+	 */
+	size_t padded() const { return (directory.size() * sizeof(uint32_t) + 63) / 64 * 64; }
+
+#ifdef NETWORK_AVX2
+	/**
+	 * gather the kept lines of 8 features from the directory, and then their weights from the lines
+	 */
+	__attribute__((target("avx2")))
+	float estimate_avx2(const uint32_t* offset, size_t n) const {
+		__m256 acc = _mm256_setzero_ps();
+		const __m256i all = _mm256_set1_epi32(-1), low = _mm256_set1_epi32(15);
+		for (size_t i = 0; i < n; i += 8) {
+			__m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset + i));
+			__m256i mask = n - i >= 8 ? all : _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+			__m256i line = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(directory.data()),
+				_mm256_srli_epi32(idx, 4), mask, 4);
+			__m256i at = _mm256_or_si256(_mm256_slli_epi32(line, 4), _mm256_and_si256(idx, low));
+			acc = _mm256_add_ps(acc, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), value.data(), at, _mm256_castsi256_ps(mask), 4));
+		}
+		alignas(32) float lane[8];
+		_mm256_store_ps(lane, acc);
+		float sum = 0;
+		for (size_t k = 0; k < 8; k++) sum += lane[k];
+		return sum;
+	}
+#endif
+
+	std::vector<uint32_t> directory;
+	weight value;
+};
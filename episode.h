@@ -6,6 +6,8 @@
 #include <sstream>
 #include <chrono>
 #include <numeric>
+#include <string>
+#include <cstdint>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
@@ -29,6 +31,26 @@ public:
 	const board& state() const { return ep_state; }
 	board::reward score() const { return ep_score; }
 
+	/**
+	 * clear the record for reuse, keeping the reserved move buffer
+	 */
+	void reset() {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_moves.clear();
+		ep_moves.reserve(10000);
+		ep_time = 0;
+		ep_open = {};
+		ep_close = {};
+	}
+
+	/**
+	 * release the unused part of the move buffer, for a record that is kept after the episode
+	 */
+	void shrink() {
+		ep_moves.shrink_to_fit();
+	}
+
 	void open_episode(const std::string& tag) {
 		ep_open = { tag, millisec() };
 	}
@@ -36,6 +58,25 @@ public:
 		ep_close = { tag, millisec() };
 	}
 	action_reward apply_action(action move) {
+		PROFILE_SCOPE(record);
+		action_reward output;
+		board::reward reward = move.apply(state());
+		if (reward == -1) {
+			output.legal_action = false;
+			output.reward = -1;
+			return output;
+		}
+		output.legal_action = true;
+		output.reward = reward;
+		ep_moves.emplace_back(move, reward, millisec() - ep_time);
+		ep_score += reward;
+		return output;
+	}
+	/**
+	 * the compiled counterpart of apply_action, for an action encoded as a trivially copyable code
+	 */
+	action_reward apply_action(action_code move) {
+		PROFILE_SCOPE(record);
 		action_reward output;
 		board::reward reward = move.apply(state());
 		if (reward == -1) {
@@ -49,6 +90,13 @@ public:
 		ep_score += reward;
 		return output;
 	}
+	/**
+	 * start the next turn, return true if the player moves in it (the same order as take_turns)
+	 */
+	bool player_turn() {
+		ep_time = millisec();
+		return (std::max(step() + 1, size_t(9)) % 2) == 0;
+	}
 	agent& take_turns(agent& play, agent& evil) {
 		ep_time = millisec();
 		return (std::max(step() + 1, size_t(9)) % 2) ? evil : play;
@@ -125,6 +173,62 @@ public:
 		return in;
 	}
 
+	/**
+	 * append the binary record of the episode to 'out'
+	 *
+	 * the format is (where 'varint' is an unsigned LEB128 integer)
+	 *  open:  varint length, tag, varint when
+	 *  moves: varint count, then for every move a code byte and its optional fields
+	 *  close: varint length, tag, varint when
+	 * the code byte of a move is
+	 *  slide: 1000 trdd, where dd is the direction, r marks a varint reward, and t marks a varint time
+	 *  place: 0tTT pppp, where TT is the tile (1 to 3), pppp is the position, and t marks a varint time
+	 */
+	void encode(std::string& out) const {
+		encode(out, ep_open);
+		put(out, ep_moves.size());
+		for (const move& mv : ep_moves) {
+			unsigned type = mv.code.type(), event = mv.code.event();
+			if (type == action::slide::type) {
+				out.push_back(char(0x80 | (mv.time ? 0x08 : 0) | (mv.reward ? 0x04 : 0) | (event & 0x03)));
+				if (mv.reward) put(out, mv.reward);
+			} else {
+				out.push_back(char((mv.time ? 0x40 : 0) | (((event >> 4) & 0x03) << 4) | (event & 0x0f)));
+			}
+			if (mv.time) put(out, mv.time);
+		}
+		encode(out, ep_close);
+	}
+	/**
+	 * read a binary record into the episode, replaying the moves to rebuild the state and the score
+	 * return the end of the record, or nullptr if it is truncated or malformed
+	 */
+	const char* decode(const char* p, const char* end) {
+		reset();
+		uint64_t size;
+		if (!(p = decode(p, end, ep_open)) || !(p = get(p, end, size))) return nullptr;
+		if (size > size_t(end - p)) return nullptr; // at least one byte per move
+		ep_moves.reserve(size);
+		for (uint64_t i = 0; i < size; i++) {
+			if (p == end) return nullptr;
+			uint8_t code = *(p++);
+			uint64_t reward = 0, time = 0;
+			action act;
+			if (code & 0x80) {
+				if ((code & 0x04) && !(p = get(p, end, reward))) return nullptr;
+				if ((code & 0x08) && !(p = get(p, end, time))) return nullptr;
+				act = action::slide(code & 0x03);
+				ep_score += ep_state.slide(code & 0x03);
+			} else {
+				if ((code & 0x40) && !(p = get(p, end, time))) return nullptr;
+				act = action::place(code & 0x0f, (code >> 4) & 0x03);
+				ep_state.place(code & 0x0f, (code >> 4) & 0x03);
+			}
+			ep_moves.emplace_back(act, board::reward(reward), time_t(time));
+		}
+		return decode(p, end, ep_close);
+	}
+
 protected:
 
 	struct move {
@@ -171,6 +275,33 @@ protected:
 		}
 	};
 
+	static void encode(std::string& out, const meta& m) {
+		put(out, m.tag.size());
+		out += m.tag;
+		put(out, m.when);
+	}
+	static const char* decode(const char* p, const char* end, meta& m) {
+		uint64_t size, when;
+		if (!(p = get(p, end, size)) || size > size_t(end - p)) return nullptr;
+		m.tag.assign(p, size);
+		if (!(p = get(p + size, end, when))) return nullptr;
+		m.when = time_t(when);
+		return p;
+	}
+	static void put(std::string& out, uint64_t v) {
+		for (; v >= 0x80; v >>= 7) out.push_back(char(v | 0x80));
+		out.push_back(char(v));
+	}
+	static const char* get(const char* p, const char* end, uint64_t& v) {
+		v = 0;
+		for (unsigned shift = 0; p != end && shift < 64; shift += 7) {
+			uint8_t b = *(p++);
+			v |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) return p;
+		}
+		return nullptr;
+	}
+
 	static board initial_state() {
 		return {};
 	}
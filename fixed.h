@@ -0,0 +1,146 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <type_traits>
+#include <cstdint>
+#include "board.h"
+
+/**
+ * n-tuple networks specialised at compile time
+ *
+ * a shape is a list of tuples given as template parameter packs of cells, e.g.,
+ *  fixed_network<false, fixed_tuple<0, 1, 2, 3>, fixed_tuple<4, 5, 6, 7>>
+ * whose views (the tuples under the isomorphisms) are computed by constexpr functions, so that the extraction of
+ * every index is unrolled into constant shifts and masks, and the table offsets are constants as well
+ *
+ * the views and the tables are laid out exactly as in network, which picks a specialised shape from the registry
+ * (see fixed_registry::find) whenever its tuples match one, and keeps its generic path for all other shapes
+ */
+template<unsigned... cells>
+struct fixed_tuple {
+	static constexpr unsigned length = sizeof...(cells);
+	static constexpr uint32_t size = uint32_t(1) << (4 * length);
+};
+
+template<class... tuples>
+struct fixed_list {};
+
+template<unsigned... k>
+struct fixed_sequence {};
+
+/**
+ * the cell of the original board at position (p) of isomorphism (k), i.e., the cell (p) of the identity board
+ * after board::reflect_horizontal (if k & 4) and board::rotate(k & 3), as in network
+ */
+constexpr unsigned fixed_reflect(unsigned k, unsigned r, unsigned c) {
+	return (k & 4) ? r * 4 + (3 - c) : r * 4 + c;
+}
+constexpr unsigned fixed_cell(unsigned k, unsigned p) {
+	return (k & 3) == 0 ? fixed_reflect(k, p / 4, p % 4)
+	     : (k & 3) == 1 ? fixed_reflect(k, 3 - p % 4, p / 4)
+	     : (k & 3) == 2 ? fixed_reflect(k, 3 - p / 4, 3 - p % 4)
+	     :                fixed_reflect(k, p % 4, 3 - p / 4);
+}
+
+template<bool iso, class... tuples>
+class fixed_network {
+public:
+	static constexpr size_t views = sizeof...(tuples) * (iso ? 8 : 1);
+
+	/**
+	 * write the offsets of the features of 'raw' into 'out' (network::extract), return their number
+	 */
+	static size_t extract(board::data raw, uint32_t stage, uint32_t* out) {
+		emit(raw, stage, out, fixed_list<tuples...>());
+		return views;
+	}
+	/**
+	 * the sum of the weights of the features of 'raw', in the same order as the generic kernels
+	 */
+	static float evaluate(board::data raw, uint32_t stage, const float* value) {
+		uint32_t offset[views];
+		emit(raw, stage, offset, fixed_list<tuples...>());
+		float lane[8] = { 0 };
+		for (size_t i = 0; i < views; i++) lane[i % 8] += value[offset[i]];
+		float sum = 0;
+		for (size_t k = 0; k < 8; k++) sum += lane[k];
+		return sum;
+	}
+
+private:
+	typedef typename std::conditional<iso, fixed_sequence<0, 1, 2, 3, 4, 5, 6, 7>, fixed_sequence<0>>::type isomorphisms;
+
+	static uint32_t join(uint32_t index) {
+		return index;
+	}
+	template<class... rest>
+	static uint32_t join(uint32_t index, uint32_t next, rest... more) {
+		return join((index << 4) | next, more...);
+	}
+	template<unsigned p>
+	static uint32_t nibble(board::data raw) {
+		return (raw >> (4 * p)) & 0x0f;
+	}
+	template<unsigned k, unsigned... cells>
+	static uint32_t index(board::data raw, fixed_tuple<cells...>) {
+		return join(0, nibble<fixed_cell(k, cells)>(raw)...);
+	}
+
+	template<class tuple, unsigned... k>
+	static uint32_t* lookup(board::data raw, uint32_t base, uint32_t* out, fixed_sequence<k...>) {
+		const uint32_t offset[] = { (base + index<k>(raw, tuple()))... };
+		for (uint32_t i : offset) *(out++) = i;
+		return out;
+	}
+	static void emit(board::data raw, uint32_t base, uint32_t* out, fixed_list<>) {}
+	template<class first, class... rest>
+	static void emit(board::data raw, uint32_t base, uint32_t* out, fixed_list<first, rest...>) {
+		out = lookup<first>(raw, base, out, isomorphisms());
+		emit(raw, base + first::size, out, fixed_list<rest...>());
+	}
+};
+
+/**
+ * the pre-instantiated shapes, looked up by their tuples (see network::tuples) and isomorphism
+ */
+class fixed_registry {
+public:
+	typedef size_t (*extract_type)(board::data raw, uint32_t stage, uint32_t* out);
+	typedef float (*evaluate_type)(board::data raw, uint32_t stage, const float* value);
+	struct entry {
+		const char* tuples;
+		bool iso;
+		extract_type extract;
+		evaluate_type evaluate;
+	};
+
+	/**
+	 * the specialised shape of 'tuples', or nullptr if it is not pre-instantiated
+	 */
+	static const entry* find(const std::string& tuples, bool iso) {
+		for (const entry& e : entries()) {
+			if (e.tuples == tuples && e.iso == iso) return &e;
+		}
+		return nullptr;
+	}
+
+private:
+	template<class shape>
+	static entry make(const char* tuples, bool iso) {
+		return { tuples, iso, &shape::extract, &shape::evaluate };
+	}
+	static const std::vector<entry>& entries() {
+		static const std::vector<entry> all = {
+			// "8x4": the 4 rows and 4 columns
+			make<fixed_network<false, fixed_tuple<0, 1, 2, 3>, fixed_tuple<4, 5, 6, 7>, fixed_tuple<8, 9, 10, 11>, fixed_tuple<12, 13, 14, 15>,
+				fixed_tuple<0, 4, 8, 12>, fixed_tuple<1, 5, 9, 13>, fixed_tuple<2, 6, 10, 14>, fixed_tuple<3, 7, 11, 15>>>(
+				"0123,4567,89ab,cdef,048c,159d,26ae,37bf", false),
+			// "2x4": the outer and inner lines
+			make<fixed_network<true, fixed_tuple<0, 1, 2, 3>, fixed_tuple<4, 5, 6, 7>>>("0123,4567", true),
+			// "4x6": 2x3 rectangles and lines with 2 extra cells
+			make<fixed_network<true, fixed_tuple<0, 1, 2, 3, 4, 5>, fixed_tuple<4, 5, 6, 7, 8, 9>,
+				fixed_tuple<0, 1, 2, 4, 5, 6>, fixed_tuple<4, 5, 6, 8, 9, 10>>>("012345,456789,012456,45689a", true),
+		};
+		return all;
+	}
+};
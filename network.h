@@ -0,0 +1,659 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include "board.h"
+#include "weight.h"
+#include "fixed.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NETWORK_AVX2 1
+#endif
+
+/**
+ * features of a board: the offsets of its weights in a network, one per (tuple, isomorphism),
+ * grouped by tuple so that consecutive lookups stay within the same table
+ */
+class features {
+public:
+	static constexpr size_t capacity = 64;
+	features() : count(0) {}
+
+	void push_back(uint32_t offset) { index[count++] = offset; }
+	void clear() { count = 0; }
+	uint32_t operator [](size_t i) const { return index[i]; }
+	size_t size() const { return count; }
+	const uint32_t* begin() const { return index.data(); }
+	const uint32_t* end() const { return index.data() + count; }
+
+private:
+	friend class network; // extracts 8 offsets at a time, see network::extract_avx2
+	std::array<uint32_t, capacity> index;
+	uint32_t count;
+};
+
+/**
+ * n-tuple network
+ *
+ * each tuple is a list of cells, whose tile indices form a 4n-bit index into the weight table of the tuple
+ * (the first cell is the most significant); with isomorphism, a tuple is evaluated over the 8 rotations
+ * and reflections of the board, and all the 8 lookups share the same table
+ *
+ * all tables are stored in one cache-line aligned weight, so a board is evaluated by summing
+ * the weights at its feature offsets; since the last cell is the least significant, the 16 entries
+ * that differ only in the last cell are exactly one cache line
+ *
+ * the evaluation runs on one of two kernels, selected at runtime (see kernel):
+ *  "avx2": the indices of 8 features are extracted at once by byte shuffles, and their weights are gathered
+ *  "scalar": the same computation one feature at a time
+ * both sum feature (i) into lane (i % 8) and then add up the 8 lanes in order, so their results are identical
+ * on the scalar kernel, the shapes of the registry (see fixed.h) are extracted and evaluated by code specialised
+ * at compile time instead, again with identical results (the shuffles of avx2 are still faster than the unrolled code)
+ */
+class network {
+public:
+	/**
+	 * 'tuples' is a named set, or a comma-separated list of tuples written in hex cells, e.g., "0123,4567"
+	 *  "" or "8x4": the 4 rows and 4 columns, each with its own table (no isomorphism by default)
+	 *  "2x4": the outer and inner lines
+	 *  "4x6": four 6-tuples of 2x3 rectangles and 4-cell lines with 2 extra cells
+	 * 'iso' is 1 or 0 to turn the isomorphism on or off, or -1 for the default (on for all but "8x4")
+	 * 'stages' is a comma-separated list of tile values, e.g., "384,768", each of which starts a new set
+	 * of weights when the largest tile of a board reaches it (at most 4 thresholds)
+	 */
+	network(const std::string& tuples = "", int iso = -1, const std::string& stages = "") {
+		std::string spec = tuples;
+		if (spec.empty() || spec == "8x4") {
+			spec = "0123,4567,89ab,cdef,048c,159d,26ae,37bf";
+			if (iso == -1) iso = 0;
+		} else if (spec == "2x4") {
+			spec = "0123,4567";
+		} else if (spec == "4x6") {
+			spec = "012345,456789,012456,45689a";
+		}
+		if (iso == -1) iso = 1;
+		isomorphic = iso;
+
+		std::stringstream ss(spec);
+		for (std::string token; std::getline(ss, token, ','); ) {
+			std::vector<unsigned> shape;
+			for (char c : token) shape.push_back(std::stoul(std::string(1, c), nullptr, 16));
+			if (shape.empty() || shape.size() > 7) invalid(tuples, "tuples should have 1 to 7 cells");
+			shapes.push_back(shape);
+		}
+
+		// the cell (i) of an isomorphic board is the cell (isomorphism[k](i)) of the original board
+		board identity;
+		for (unsigned i = 0; i < 16; i++) identity(i) = i;
+		std::vector<board> isomorphism;
+		for (int k = 0; k < (iso ? 8 : 1); k++) {
+			board b = identity;
+			if (k & 4) b.reflect_horizontal();
+			b.rotate(k & 3);
+			isomorphism.push_back(b);
+		}
+
+		uint64_t total = 0;
+		for (const std::vector<unsigned>& shape : shapes) {
+			base.push_back(total);
+			for (const board& b : isomorphism) {
+				view v;
+				v.base = total;
+				v.length = shape.size();
+				for (size_t j = 0; j < shape.size(); j++) v.cells[j] = b(shape[j]);
+				views.push_back(v);
+			}
+			total += uint64_t(1) << (shape.size() * 4);
+		}
+		std::stringstream st(stages);
+		for (std::string token; std::getline(st, token, ','); ) {
+			const int* tile = std::find(board::index_to_tile + 1, board::index_to_tile + 16, std::stoi(token));
+			if (tile == board::index_to_tile + 16) invalid(tuples, "unknown stage tile " + token);
+			thresholds.push_back(tile - board::index_to_tile);
+		}
+		if (thresholds.size() > 4 || !std::is_sorted(thresholds.begin(), thresholds.end())) invalid(tuples, "stages should be at most 4 ascending tiles");
+
+		if (views.size() > features::capacity) invalid(tuples, "too many features per board");
+		if (total * (thresholds.size() + 1) > UINT32_MAX) invalid(tuples, "too many weights");
+		stage_length = total;
+		length = total * (thresholds.size() + 1);
+
+		// the shuffle of view (i) is the 8-byte lane (i % 4) of group (i / 4), where the cells are right-aligned,
+		// so that their nibbles form the index from the most significant byte
+		control.assign((views.size() + 7) / 8 * 8 * 8, 0x80);
+		offsets.assign((views.size() + 7) / 8 * 8, 0);
+		for (size_t i = 0; i < views.size(); i++) {
+			uint8_t* lane = &control[(i / 4) * 32 + (i % 4) * 8];
+			for (unsigned j = 0; j < views[i].length; j++) lane[8 - views[i].length + j] = views[i].cells[j];
+			offsets[i] = views[i].base;
+		}
+		fixed = fixed_registry::find(this->tuples(), isomorphic);
+	}
+
+	/**
+	 * allocate all tables and fill them with zero
+	 */
+	void init() {
+		value = weight(length);
+	}
+
+	/**
+	 * free all tables, e.g., once they are compacted (see compact.h); the layout is kept
+	 */
+	void release() {
+		value = weight();
+		accum = weight();
+		absolute = weight();
+	}
+
+	/**
+	 * a copy of the weights, e.g., published by a learner to its actors
+	 */
+	std::shared_ptr<const weight> snapshot() const {
+		return std::make_shared<const weight>(value);
+	}
+	/**
+	 * evaluate with a snapshot of a network of the same layout, without copying; the network must never be updated
+	 * return false if the size differs
+	 */
+	bool share(const std::shared_ptr<const weight>& w) {
+		if (w->size() != length) return false;
+		value = weight::share(w);
+		return true;
+	}
+
+	bool empty() const { return value.size() == 0; }
+	bool mapped() const { return value.mapped(); }
+	/**
+	 * the tables of all stages, where table (i) belongs to stage (i / shapes) and tuple (i % shapes)
+	 */
+	size_t tables() const { return shapes.size() * stages(); }
+	size_t table_size(size_t i) const { return size_t(1) << (shapes[i % shapes.size()].size() * 4); }
+	size_t table_offset(size_t i) const { return (i / shapes.size()) * stage_length + base[i % shapes.size()]; }
+	size_t stages() const { return thresholds.size() + 1; }
+	size_t stage_size() const { return stage_length; }
+	size_t size() const { return length; }
+	const weight& weights() const { return value; }
+
+	/**
+	 * the tuples in hex cells and whether they are shared over isomorphisms, i.e., the arguments of the layout
+	 */
+	std::string tuples() const {
+		std::string spec;
+		for (const std::vector<unsigned>& shape : shapes) {
+			if (spec.size()) spec += ',';
+			for (unsigned cell : shape) spec += "0123456789abcdef"[cell];
+		}
+		return spec;
+	}
+	bool iso() const { return isomorphic; }
+	std::string stage_tiles() const {
+		std::string spec;
+		for (board::cell t : thresholds) spec += (spec.size() ? "," : "") + std::to_string(board::index_to_tile[t]);
+		return spec;
+	}
+
+public:
+	features extract(const board& b) const {
+		features f;
+		extract(b, f);
+		return f;
+	}
+	/**
+	 * extract the features of 'b' into 'f' in place, e.g., into a slot kept for later (see weight_agent::chosen)
+	 */
+	void extract(const board& b, features& f) const {
+#ifdef NETWORK_AVX2
+		if (kernel() == avx2) {
+			f.count = extract_avx2(b, f.index.data());
+			return;
+		}
+#endif
+		if (fixed) {
+			f.count = fixed->extract(b.raw(), stage(b), f.index.data());
+			return;
+		}
+		uint32_t stage = this->stage(b);
+		f.clear();
+		for (const view& v : views) {
+			uint32_t index = 0;
+			for (unsigned j = 0; j < v.length; j++) index = (index << 4) | b(v.cells[j]);
+			f.push_back(stage + v.base + index);
+		}
+	}
+	float estimate(const features& f) const {
+#ifdef NETWORK_AVX2
+		if (kernel() == avx2 && length <= INT32_MAX) return estimate_avx2(f.begin(), f.size());
+#endif
+		float lane[8] = { 0 };
+		for (size_t i = 0; i < f.size(); i++) lane[i % 8] += value[f[i]];
+		return reduce(lane);
+	}
+	/**
+	 * fetch the weights of the features into the cache ahead of estimate()
+	 */
+	void prefetch(const features& f) const {
+		for (uint32_t offset : f) __builtin_prefetch(&value[offset]);
+	}
+	/**
+	 * the value of a board, i.e., estimate(extract(b))
+	 */
+	float evaluate(const board& b) const {
+#ifdef NETWORK_AVX2
+		if (kernel() == avx2 && length <= INT32_MAX) return evaluate_avx2(b);
+#endif
+		if (fixed) return fixed->evaluate(b.raw(), stage(b), value.data());
+		return estimate(extract(b));
+	}
+	/**
+	 * the values of the boards (i) in 'mask' in one pass, e.g., the legal afterstates of a state (see board::expand)
+	 * every view is read once for up to 4 boards: on avx2, the shuffles and offsets of 8 views are loaded once
+	 * and the gathers of the boards are interleaved; on the scalar kernel, the cells of a view are shared
+	 * the value of each board is the same as evaluate(b[i])
+	 */
+	void evaluate(const board* b, unsigned mask, float* v) const {
+		while (mask) {
+			unsigned batch[4], n = 0;
+			for (; mask && n < 4; mask &= mask - 1) batch[n++] = __builtin_ctz(mask);
+#ifdef NETWORK_AVX2
+			if (kernel() == avx2 && length <= INT32_MAX) {
+				evaluate_avx2(b, batch, n, v);
+				continue;
+			}
+#endif
+			if (fixed) {
+				for (unsigned k = 0; k < n; k++) v[batch[k]] = fixed->evaluate(b[batch[k]].raw(), stage(b[batch[k]]), value.data());
+				continue;
+			}
+			uint32_t stage[4];
+			float lane[4][8] = { { 0 } };
+			for (unsigned k = 0; k < n; k++) stage[k] = this->stage(b[batch[k]]);
+			for (size_t i = 0; i < views.size(); i++) {
+				const view& w = views[i];
+				for (unsigned k = 0; k < n; k++) {
+					const board& x = b[batch[k]];
+					uint32_t index = 0;
+					for (unsigned j = 0; j < w.length; j++) index = (index << 4) | x(w.cells[j]);
+					lane[k][i % 8] += value[stage[k] + w.base + index];
+				}
+			}
+			for (unsigned k = 0; k < n; k++) v[batch[k]] = reduce(lane[k]);
+		}
+	}
+
+	/**
+	 * the evaluation kernel of all networks, the best one supported by the CPU unless selected by use()
+	 */
+	enum simd { scalar, avx2 };
+	static simd kernel() {
+		return select();
+	}
+	/**
+	 * select the kernel by name ("scalar", "avx2", or "auto"), return false if it is unknown or unsupported
+	 */
+	static bool use(const std::string& name) {
+		if (name == "scalar") return select() = scalar, true;
+		if (name == "auto") return select() = detect(), true;
+		if (name == "avx2" && detect() == avx2) return select() = avx2, true;
+		return false;
+	}
+	static const char* name(simd k) {
+		return k == avx2 ? "avx2" : "scalar";
+	}
+	/**
+	 * whether this network is evaluated by a specialised shape (see fixed_registry), which can be turned off
+	 */
+	bool specialised() const { return fixed != nullptr; }
+	void specialise(bool on) {
+		fixed = on ? fixed_registry::find(tuples(), isomorphic) : nullptr;
+	}
+	void update(const features& f, float delta) {
+		for (uint32_t offset : f) value[offset] += delta;
+	}
+
+	/**
+	 * temporal coherence: each weight learns at its own rate |E| / A, where E and A accumulate
+	 * the errors and the absolute errors it has been updated with (the rate is 1 before any update)
+	 * the accumulators are training state only, and are not saved with the weights
+	 */
+	void coherence() {
+		if (accum.size() == 0) accum = weight(length), absolute = weight(length);
+	}
+	bool coherent() const { return accum.size() != 0; }
+	void update(const features& f, float alpha, float error) {
+		for (uint32_t offset : f) {
+			float rate = absolute[offset] ? std::abs(accum[offset]) / absolute[offset] : 1.0f;
+			value[offset] += alpha * rate * error;
+			accum[offset] += error;
+			absolute[offset] += std::abs(error);
+		}
+	}
+
+public:
+	/**
+	 * the table count (uint32_t), then each table (of all stages) as its size (uint64_t) and weights
+	 * the layout itself comes from the arguments; files written before this format may carry
+	 * a garbage table count, so only the size of each table is checked when reading
+	 */
+	friend std::ostream& operator <<(std::ostream& out, const network& net) {
+		uint32_t size = net.tables();
+		out.write(reinterpret_cast<const char*>(&size), sizeof(uint32_t));
+		for (size_t i = 0; i < net.tables(); i++) {
+			uint64_t len = net.table_size(i);
+			out.write(reinterpret_cast<const char*>(&len), sizeof(uint64_t));
+			out.write(reinterpret_cast<const char*>(net.value.data() + net.table_offset(i)), sizeof(float) * len);
+		}
+		return out;
+	}
+	friend std::istream& operator >>(std::istream& in, network& net) {
+		uint32_t size = 0;
+		in.read(reinterpret_cast<char*>(&size), sizeof(uint32_t));
+		net.init();
+		for (size_t i = 0; i < net.tables() && in; i++) {
+			uint64_t len = 0;
+			in.read(reinterpret_cast<char*>(&len), sizeof(uint64_t));
+			if (len != net.table_size(i)) {
+				in.setstate(std::ios::failbit);
+				break;
+			}
+			in.read(reinterpret_cast<char*>(net.value.data() + net.table_offset(i)), sizeof(float) * len);
+		}
+		return in;
+	}
+
+public:
+	/**
+	 * the mapped weight file format (version 2), a page-aligned header followed by all tables:
+	 *  magic "NTUPLEW\0", version, tuple count, isomorphism, stage thresholds, the cells of each tuple,
+	 *  then the offset and length of the weights (in floats) and their checksum,
+	 *  and finally the checksum of the header itself (with this field as zero)
+	 * files without the magic are in the stream format above (version 1),
+	 * and version 3 is the compact format of the same layout (see compact.h)
+	 */
+	struct header {
+		char magic[8];
+		uint32_t version;
+		uint32_t tables;
+		uint32_t iso;
+		uint8_t stage[4]; // tile indices starting each stage, 0 for unused
+		uint8_t shape[features::capacity][8]; // length, then cells
+		uint64_t offset;
+		uint64_t length;
+		uint64_t checksum;
+		uint64_t self;
+		uint64_t lines; // the lines of weights kept in a compact file, 0 otherwise
+		char padding[4096 - 24 - features::capacity * 8 - 40];
+
+		bool valid() const {
+			header h = *this;
+			h.self = 0;
+			return std::memcmp(magic, "NTUPLEW", 8) == 0 && (version == 2 || version == 3) && self == network::checksum(&h, sizeof(h));
+		}
+	};
+	static_assert(sizeof(header) == 4096, "the weights should start at a page boundary");
+
+	/**
+	 * a 64-bit checksum of a buffer whose size is a multiple of 8
+	 */
+	static uint64_t checksum(const void* buf, size_t size) {
+		const uint64_t* word = static_cast<const uint64_t*>(buf);
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (size_t i = 0; i < size / 8; i++) hash = (hash ^ word[i]) * 0x100000001b3ull;
+		return hash ^ (hash >> 32);
+	}
+
+	/**
+	 * read the header of a mapped weight file, return false if the file is not in the mapped format
+	 */
+	static bool probe(const std::string& path, header& h) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		return in.read(reinterpret_cast<char*>(&h), sizeof(h)) && h.valid();
+	}
+
+	/**
+	 * map the weights of a file in the mapped format, whose layout must be the same as this network
+	 * a read-only network must never be updated; a writable one is copy-on-write
+	 * with 'verify', the checksum of the weights is checked as well (this reads the whole file)
+	 */
+	bool map(const std::string& path, bool writable, bool verify = false) {
+		header h;
+		if (!probe(path, h) || h.version != 2 || !fits(h)) return false;
+		weight w = weight::map(path, h.offset, h.length, writable);
+		if (w.size() != length) return false;
+		if (verify && checksum(w.data(), w.size() * sizeof(float)) != h.checksum) return false;
+		value = std::move(w);
+		return true;
+	}
+
+	/**
+	 * save in the mapped format; the file is replaced atomically, so that it may be mapped by this network itself
+	 */
+	bool save(const std::string& path) const {
+		header h = layout();
+		h.offset = sizeof(h);
+		h.checksum = checksum(value.data(), value.size() * sizeof(float));
+		h.self = checksum(&h, sizeof(h));
+
+		std::string temp = path + ".tmp";
+		std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		out.write(reinterpret_cast<const char*>(value.data()), sizeof(float) * value.size());
+		out.close();
+		return out && std::rename(temp.c_str(), path.c_str()) == 0;
+	}
+
+	/**
+	 * a header of the layout of this network, without the offset and checksums of the weights
+	 */
+	header layout() const {
+		header h;
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.magic, "NTUPLEW", 8);
+		h.version = 2;
+		h.tables = shapes.size();
+		h.iso = iso();
+		for (size_t i = 0; i < thresholds.size(); i++) h.stage[i] = thresholds[i];
+		for (size_t i = 0; i < shapes.size(); i++) {
+			h.shape[i][0] = shapes[i].size();
+			for (size_t j = 0; j < shapes[i].size(); j++) h.shape[i][j + 1] = shapes[i][j];
+		}
+		h.length = length;
+		return h;
+	}
+	/**
+	 * whether a header describes the layout of this network
+	 */
+	bool fits(const header& h) const {
+		if (h.tables != shapes.size() || bool(h.iso) != iso() || h.length != length) return false;
+		for (size_t i = 0; i < 4; i++) {
+			if (h.stage[i] != (i < thresholds.size() ? thresholds[i] : 0)) return false;
+		}
+		for (size_t i = 0; i < shapes.size(); i++) {
+			if (h.shape[i][0] != shapes[i].size()) return false;
+			for (size_t j = 0; j < shapes[i].size(); j++) if (h.shape[i][j + 1] != shapes[i][j]) return false;
+		}
+		return true;
+	}
+
+private:
+	/**
+	 * the offset of the weights of the stage of 'b'
+	 */
+	uint32_t stage(const board& b) const {
+		uint32_t stage = 0;
+		if (thresholds.size()) {
+			board::cell top = b.max_tile();
+			for (board::cell t : thresholds) stage += (top >= t);
+			stage *= stage_length;
+		}
+		return stage;
+	}
+
+	static simd& select() {
+		static simd k = detect();
+		return k;
+	}
+	static simd detect() {
+#ifdef NETWORK_AVX2
+		if (__builtin_cpu_supports("avx2")) return avx2;
+#endif
+		return scalar;
+	}
+	static float reduce(const float lane[8]) {
+		float sum = 0;
+		for (size_t k = 0; k < 8; k++) sum += lane[k];
+		return sum;
+	}
+
+#ifdef NETWORK_AVX2
+	__attribute__((target("avx2")))
+	float estimate_avx2(const uint32_t* offset, size_t n) const {
+		__m256 acc = _mm256_setzero_ps();
+		for (size_t i = 0; i < n; i += 8) {
+			__m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset + i));
+			if (n - i >= 8) {
+				acc = _mm256_add_ps(acc, _mm256_i32gather_ps(value.data(), idx, 4));
+			} else {
+				__m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+				acc = _mm256_add_ps(acc, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), value.data(), idx, _mm256_castsi256_ps(mask), 4));
+			}
+		}
+		alignas(32) float lane[8];
+		_mm256_store_ps(lane, acc);
+		return reduce(lane);
+	}
+
+	/**
+	 * extract the features of 'b' and gather their weights
+	 */
+	__attribute__((target("avx2")))
+	float evaluate_avx2(const board& b) const {
+		alignas(32) uint32_t offset[features::capacity];
+		return estimate_avx2(offset, extract_avx2(b, offset));
+	}
+
+	/**
+	 * extract the features of 'b' into 'out' 8 at a time, which may be written up to a multiple of 8, return their number
+	 * the cells are unpacked into bytes, shuffled into the 8-byte lanes of 4 views,
+	 * and the nibbles of each lane are joined by multiply-adds into its index
+	 */
+	__attribute__((target("avx2")))
+	size_t extract_avx2(const board& b, uint32_t* out) const {
+		__m256i both = cells_avx2(b);
+		const __m256i shift = _mm256_set1_epi32(int32_t(stage(b)));
+		size_t n = views.size();
+		for (size_t i = 0; i < n; i += 8) {
+			__m256i idx = index_avx2(both, shuffle_avx2(i), shuffle_avx2(i + 4));
+			idx = _mm256_add_epi32(idx, _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&offsets[i])), shift));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), idx);
+		}
+		return n;
+	}
+
+	/**
+	 * evaluate the boards (batch[k]) of 'b' into 'v' (see evaluate), with the lanes of each board summed as in estimate_avx2
+	 */
+	__attribute__((target("avx2")))
+	void evaluate_avx2(const board* b, const unsigned* batch, unsigned m, float* v) const {
+		__m256i both[4], shift[4];
+		__m256 acc[4];
+		for (unsigned k = 0; k < m; k++) {
+			both[k] = cells_avx2(b[batch[k]]);
+			shift[k] = _mm256_set1_epi32(int32_t(stage(b[batch[k]])));
+			acc[k] = _mm256_setzero_ps();
+		}
+		size_t n = views.size();
+		for (size_t i = 0; i < n; i += 8) {
+			__m256i base = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&offsets[i]));
+			__m256i first = shuffle_avx2(i), second = shuffle_avx2(i + 4);
+			__m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+			for (unsigned k = 0; k < m; k++) {
+				__m256i idx = _mm256_add_epi32(index_avx2(both[k], first, second), _mm256_add_epi32(base, shift[k]));
+				if (n - i >= 8) {
+					acc[k] = _mm256_add_ps(acc[k], _mm256_i32gather_ps(value.data(), idx, 4));
+				} else {
+					acc[k] = _mm256_add_ps(acc[k], _mm256_mask_i32gather_ps(_mm256_setzero_ps(), value.data(), idx, _mm256_castsi256_ps(mask), 4));
+				}
+			}
+		}
+		for (unsigned k = 0; k < m; k++) {
+			alignas(32) float lane[8];
+			_mm256_store_ps(lane, acc[k]);
+			v[batch[k]] = reduce(lane);
+		}
+	}
+
+	/**
+	 * the cells of 'b' as bytes, in both halves of a vector
+	 */
+	__attribute__((target("avx2")))
+	static __m256i cells_avx2(const board& b) {
+		board::data raw = b.raw();
+		__m128i lo = _mm_cvtsi64_si128(int64_t(raw & 0x0f0f0f0f0f0f0f0full));
+		__m128i hi = _mm_cvtsi64_si128(int64_t((raw >> 4) & 0x0f0f0f0f0f0f0f0full));
+		__m128i cells = _mm_unpacklo_epi8(lo, hi); // byte (i) is cell (i)
+		return _mm256_broadcastsi128_si256(cells);
+	}
+	/**
+	 * the byte shuffles of views (i .. i + 3)
+	 */
+	__attribute__((target("avx2")))
+	__m256i shuffle_avx2(size_t i) const {
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&control[(i / 4) * 32]));
+	}
+	/**
+	 * the indices of views (i .. i + 7) in their tables, from the cells of a board and the shuffles of views (i .. i + 3) and (i + 4 .. i + 7)
+	 */
+	__attribute__((target("avx2")))
+	static __m256i index_avx2(__m256i both, __m256i first, __m256i second) {
+		const __m256i nibble = _mm256_set1_epi16(0x0110); // bytes 16, 1
+		const __m256i word = _mm256_set1_epi32(0x00010100); // words 256, 1
+		const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+		__m256i index[2], ctrl[2] = { first, second };
+		for (size_t h = 0; h < 2; h++) {
+			__m256i v = _mm256_shuffle_epi8(both, ctrl[h]);
+			v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, nibble), word);
+			v = _mm256_or_si256(_mm256_slli_epi64(v, 16), _mm256_srli_epi64(v, 32)); // the low dword of each lane
+			index[h] = _mm256_permutevar8x32_epi32(v, even);
+		}
+		return _mm256_blend_epi32(index[0], index[1], 0xf0); // views (i .. i + 7)
+	}
+#endif
+
+	static void invalid(const std::string& tuples, const std::string& why) {
+		std::cerr << "invalid tuples=" << tuples << ": " << why << std::endl;
+		std::exit(1);
+	}
+
+	/**
+	 * a tuple under one isomorphism: the cells to read, and the offset of its table
+	 */
+	struct view {
+		uint32_t base;
+		uint32_t length;
+		std::array<uint8_t, 8> cells;
+	};
+
+	std::vector<std::vector<unsigned>> shapes;
+	std::vector<uint64_t> base;
+	std::vector<view> views;
+	std::vector<board::cell> thresholds;
+	std::vector<uint8_t> control; // the byte shuffles of every 4 views, for the avx2 kernel
+	std::vector<uint32_t> offsets; // the table offsets of all views, padded to a multiple of 8
+	const fixed_registry::entry* fixed; // the specialised shape, if any
+	bool isomorphic;
+	uint64_t stage_length;
+	uint64_t length;
+	weight value;
+	weight accum;
+	weight absolute;
+};
@@ -0,0 +1,245 @@
+#pragma once
+/**
+ * per-phase profiler of the hot path, compiled in with -DPROFILE (see 'make profile')
+ *
+ * PROFILE_SCOPE(phase) charges the time until the end of the enclosing block to 'phase',
+ * excluding the time of the scopes nested in it, so that the phases add up to the profiled time
+ * the time is read from the TSC (calibrated against steady_clock) on x86, or from steady_clock elsewhere
+ *
+ * every thread keeps its own counters, which are summed by show() (per block, next to the statistic)
+ * and by dump() (the whole run, as CSV or JSON)
+ * without PROFILE, the macros expand to nothing
+ */
+#ifdef PROFILE
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class profiler {
+public:
+	enum phase { slide, extract, evaluate, place, record, update, phases };
+
+	/**
+	 * the samples of a phase, with a histogram of 4 buckets per power of 2 for the percentiles
+	 */
+	struct counter {
+		uint64_t count = 0, ticks = 0, max = 0;
+		uint64_t bucket[256] = { 0 };
+
+		void add(uint64_t t) {
+			count++;
+			ticks += t;
+			max = std::max(max, t);
+			bucket[index(t)]++;
+		}
+		void merge(const counter& c) {
+			count += c.count;
+			ticks += c.ticks;
+			max = std::max(max, c.max);
+			for (size_t i = 0; i < 256; i++) bucket[i] += c.bucket[i];
+		}
+		/**
+		 * the lower bound of the bucket of the p-th percentile
+		 */
+		uint64_t percentile(double p) const {
+			uint64_t rank = uint64_t(p / 100 * count), seen = 0;
+			for (size_t i = 0; i < 256; i++) {
+				seen += bucket[i];
+				if (seen > rank) return lower(i);
+			}
+			return max;
+		}
+		static size_t index(uint64_t t) {
+			if (t < 4) return t;
+			unsigned log = 63 - __builtin_clzll(t);
+			return (log << 2) | ((t >> (log - 2)) & 3);
+		}
+		static uint64_t lower(size_t i) {
+			if (i < 4) return i;
+			return uint64_t(4 | (i & 3)) << ((i >> 2) - 2);
+		}
+	};
+
+	/**
+	 * the exclusive time of a phase, see PROFILE_SCOPE
+	 */
+	class scope {
+	public:
+		scope(phase p) : p(p), parent(active), spent(0) {
+			uint64_t t = now();
+			if (parent) parent->spent += t - parent->mark;
+			mark = t;
+			active = this;
+		}
+		~scope() {
+			uint64_t t = now();
+			spent += t - mark;
+			local().block[p].add(spent);
+			active = parent;
+			if (parent) parent->mark = t;
+		}
+	private:
+		phase p;
+		scope* parent;
+		uint64_t spent, mark;
+	};
+
+public:
+	/**
+	 * show the percentiles of every phase since the last call, and start a new block
+	 */
+	static void show() {
+		std::vector<counter> sum(phases);
+		std::lock_guard<std::mutex> lock(threads().guard);
+		for (profile* t : threads().all) {
+			for (size_t i = 0; i < phases; i++) {
+				sum[i].merge(t->block[i]);
+				t->total[i].merge(t->block[i]);
+				t->block[i] = {};
+			}
+		}
+		uint64_t ticks = 0;
+		for (const counter& c : sum) ticks += c.ticks;
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::fixed << std::setprecision(1);
+		for (size_t i = 0; i < phases; i++) {
+			const counter& c = sum[i];
+			if (c.count == 0) continue;
+			std::cout << "\t" << std::left << std::setw(9) << name(i) << std::right;
+			std::cout << "\t" << (c.ticks * 100.0 / ticks) << "%";
+			std::cout << "\t" "n = " << c.count;
+			std::cout << ", mean = " << ns(double(c.ticks) / c.count) << "ns";
+			std::cout << ", p50 = " << ns(c.percentile(50)) << "ns";
+			std::cout << ", p90 = " << ns(c.percentile(90)) << "ns";
+			std::cout << ", p99 = " << ns(c.percentile(99)) << "ns";
+			std::cout << ", max = " << ns(c.max) << "ns";
+			std::cout << std::endl;
+		}
+		std::cout.copyfmt(ff);
+	}
+
+	/**
+	 * write the profile of the whole run to 'path', as CSV if it ends with ".csv", or as JSON otherwise
+	 */
+	static bool dump(const std::string& path) {
+		std::vector<counter> sum(phases);
+		{
+			std::lock_guard<std::mutex> lock(threads().guard);
+			for (profile* t : threads().all) {
+				for (size_t i = 0; i < phases; i++) {
+					sum[i].merge(t->total[i]);
+					sum[i].merge(t->block[i]);
+				}
+			}
+		}
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) return false;
+		bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+		if (csv) out << "phase,count,total_ns,mean_ns,p50_ns,p90_ns,p99_ns,max_ns" << std::endl;
+		else out << "{" << std::endl << "\t\"phases\": [" << std::endl;
+		for (size_t i = 0; i < phases; i++) {
+			const counter& c = sum[i];
+			double mean = c.count ? double(c.ticks) / c.count : 0;
+			if (csv) {
+				out << name(i) << "," << c.count << "," << ns(c.ticks) << "," << ns(mean) << ",";
+				out << ns(c.percentile(50)) << "," << ns(c.percentile(90)) << "," << ns(c.percentile(99)) << "," << ns(c.max) << std::endl;
+			} else {
+				out << "\t\t{\"phase\": \"" << name(i) << "\", \"count\": " << c.count << ", \"total_ns\": " << ns(c.ticks);
+				out << ", \"mean_ns\": " << ns(mean) << ", \"p50_ns\": " << ns(c.percentile(50));
+				out << ", \"p90_ns\": " << ns(c.percentile(90)) << ", \"p99_ns\": " << ns(c.percentile(99));
+				out << ", \"max_ns\": " << ns(c.max) << "}" << (i + 1 < phases ? "," : "") << std::endl;
+			}
+		}
+		if (!csv) out << "\t]" << std::endl << "}" << std::endl;
+		return bool(out);
+	}
+
+	static const char* name(size_t p) {
+		static const char* names[] = { "slide", "extract", "evaluate", "place", "record", "update" };
+		return names[p];
+	}
+
+private:
+	/**
+	 * the counters of a thread, registered for show() and dump() and never freed,
+	 * so that the samples of finished threads are kept
+	 */
+	struct profile {
+		counter block[phases];
+		counter total[phases];
+	};
+	struct registry {
+		std::mutex guard;
+		std::vector<profile*> all;
+	};
+	static registry& threads() {
+		static registry r;
+		return r;
+	}
+	static profile& local() {
+		static thread_local profile* p = nullptr;
+		if (!p) {
+			origin();
+			p = new profile();
+			std::lock_guard<std::mutex> lock(threads().guard);
+			threads().all.push_back(p);
+		}
+		return *p;
+	}
+
+	static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+	/**
+	 * the time and ticks of the first sample, to calibrate the ticks against steady_clock
+	 */
+	struct epoch {
+		std::chrono::steady_clock::time_point start;
+		uint64_t ticks;
+	};
+	static const epoch& origin() {
+		static const epoch e = { std::chrono::steady_clock::now(), now() };
+		return e;
+	}
+	/**
+	 * convert ticks to nanoseconds
+	 */
+	static double ns(double ticks) {
+#if defined(__x86_64__) || defined(__i386__)
+		double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin().start).count();
+		uint64_t ticked = now() - origin().ticks;
+		return ticked && elapsed > 1e6 ? ticks * elapsed / ticked : ticks;
+#else
+		return ticks;
+#endif
+	}
+
+	static thread_local scope* active;
+};
+thread_local profiler::scope* profiler::active = nullptr;
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(phase) profiler::scope PROFILE_CONCAT(profile_scope_, __LINE__)(profiler::phase)
+#define PROFILE_SHOW() profiler::show()
+#define PROFILE_DUMP(path) profiler::dump(path)
+#else
+#define PROFILE_SCOPE(phase)
+#define PROFILE_SHOW()
+#define PROFILE_DUMP(path) false
+#endif
@@ -0,0 +1,142 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "weight.h"
+#include "network.h"
+
+/**
+ * quantized copy of a network for evaluation-only runs, with half-sized tables
+ *
+ * each table (t) is stored as 16-bit codes with its own scale s(t), so that a weight is s(t) * code
+ *  "int16": fixed-point codes, the lookups of a table are accumulated as integers
+ *           and scaled once per table
+ *  "float16": half-precision codes, accumulated as floats and scaled once per table
+ *
+ * the codes use the same offsets as the float tables, so the features of a board are unchanged
+ */
+class quantized {
+public:
+	enum format { int16, float16 };
+
+	quantized(const network& net, const std::string& type) : fmt(type == "float16" ? float16 : int16) {
+		if (type != "int16" && type != "float16") {
+			std::cerr << "unknown quantize: " << type << std::endl;
+			std::exit(1);
+		}
+		const weight& w = net.weights();
+		code.assign(w.size(), 0);
+		per = net.iso() ? 8 : 1;
+		shapes = net.tables() / net.stages();
+		stage_length = net.stage_size();
+		for (size_t t = 0; t < net.tables(); t++) {
+			size_t begin = net.table_offset(t), end = begin + net.table_size(t);
+			float top = 0;
+			for (size_t i = begin; i < end; i++) top = std::max(top, std::abs(w[i]));
+			// int16 codes span [-32767, 32767]; float16 codes stay below its largest finite value 65504
+			float s = top > 0 ? top / (fmt == int16 ? 32767.0f : 60000.0f) : 1.0f;
+			scale.push_back(s);
+			for (size_t i = begin; i < end; i++) {
+				float v = w[i] / s;
+				code[i] = fmt == int16 ? uint16_t(int16_t(std::lround(v))) : float_to_half(v);
+			}
+		}
+	}
+
+	float estimate(const features& f) const {
+		float sum = 0;
+		const uint32_t* offset = f.begin();
+		const float* sc = scale.data() + (f[0] / stage_length) * shapes; // all features share a stage
+		if (fmt == int16) {
+			for (size_t t = 0; t < shapes; t++) {
+				int32_t acc = 0;
+				for (size_t k = 0; k < per; k++) acc += int16_t(code[*(offset++)]);
+				sum += acc * sc[t];
+			}
+		} else {
+			for (size_t t = 0; t < shapes; t++) {
+				float acc = 0;
+				for (size_t k = 0; k < per; k++) acc += half_to_float(code[*(offset++)]);
+				sum += acc * sc[t];
+			}
+		}
+		return sum;
+	}
+
+	std::string name() const { return fmt == int16 ? "int16" : "float16"; }
+	size_t bytes() const { return code.size() * sizeof(uint16_t); }
+
+public:
+	static uint16_t float_to_half(float f) {
+		uint32_t x;
+		std::memcpy(&x, &f, sizeof(x));
+		uint32_t sign = (x >> 16) & 0x8000;
+		int exp = int((x >> 23) & 0xff) - 127 + 15;
+		uint32_t man = x & 0x7fffff;
+		if (exp >= 31) return sign | 0x7c00;
+		if (exp <= 0) { // subnormal, rounded to nearest even
+			if (exp < -10) return sign;
+			man |= 0x800000;
+			uint32_t shift = 14 - exp;
+			uint32_t h = man >> shift, rem = man & ((1u << shift) - 1), half = 1u << (shift - 1);
+			if (rem > half || (rem == half && (h & 1))) h++;
+			return sign | h;
+		}
+		uint32_t h = (exp << 10) | (man >> 13), rem = man & 0x1fff;
+		if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++; // a carry correctly rounds up the exponent
+		return sign | h;
+	}
+	static float half_to_float(uint16_t h) {
+		uint32_t sign = uint32_t(h & 0x8000) << 16, exp = (h >> 10) & 0x1f, man = h & 0x3ff;
+		if (exp == 0) {
+			float f = man * (1.0f / 16777216.0f);
+			return sign ? -f : f;
+		}
+		uint32_t x = sign | (exp == 31 ? 0x7f800000u : (exp + 112) << 23) | (man << 13);
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+
+private:
+	format fmt;
+	size_t per; // lookups per table
+	size_t shapes; // tables per stage
+	size_t stage_length;
+	std::vector<uint16_t, aligned_allocator<uint16_t>> code;
+	std::vector<float> scale;
+};
+
+/**
+ * the divergence of a quantized network from its float network,
+ * accumulated over the afterstates of a reference set of positions
+ */
+struct divergence {
+	size_t states = 0, positions = 0, agree = 0;
+	double abs_error = 0, max_error = 0, abs_value = 0;
+
+	void record(float exact, float approx) {
+		double error = std::abs(double(exact) - double(approx));
+		abs_error += error;
+		abs_value += std::abs(exact);
+		max_error = std::max(max_error, error);
+		states++;
+	}
+	void choose(int exact, int approx) {
+		positions++;
+		agree += (exact == approx);
+	}
+
+	friend std::ostream& operator <<(std::ostream& out, const divergence& d) {
+		size_t n = std::max(d.states, size_t(1));
+		out << "mean error = " << (d.abs_error / n);
+		out << " (" << (d.abs_value ? d.abs_error * 100.0 / d.abs_value : 0.0) << "%)";
+		out << ", max error = " << d.max_error;
+		out << ", move agreement = " << (d.agree * 100.0 / std::max(d.positions, size_t(1))) << "%";
+		out << " over " << d.positions << " positions";
+		return out;
+	}
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * bounded lock-free queue for any number of producers and consumers, e.g., the trajectories of many actors to one learner
+ *
+ * slot (i) carries a sequence number: a producer may fill the slot at position (pos) if its sequence is pos,
+ * and then sets it to pos + 1, after which a consumer may take it and set it to pos + size, i.e., free for the next round
+ * the positions are claimed by compare-and-swap, so no thread ever waits for another unless the queue is full or empty
+ * the capacity is rounded up to a power of 2, and the head and the tail are kept on separate cache lines
+ */
+template<class type>
+class ring {
+public:
+	ring(size_t capacity) : slots(round(capacity)), mask(slots.size() - 1), head(0), tail(0) {
+		for (size_t i = 0; i < slots.size(); i++) slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	/**
+	 * append 'v', return false if the queue is full
+	 */
+	bool try_push(const type& v) {
+		size_t pos = tail.load(std::memory_order_relaxed);
+		while (true) {
+			slot& s = slots[pos & mask];
+			intptr_t dif = intptr_t(s.seq.load(std::memory_order_acquire)) - intptr_t(pos);
+			if (dif == 0 && tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				s.value = v;
+				s.seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+			if (dif < 0) return false;
+			if (dif > 0) pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+	/**
+	 * take the first value into 'v', return false if the queue is empty
+	 */
+	bool try_pop(type& v) {
+		size_t pos = head.load(std::memory_order_relaxed);
+		while (true) {
+			slot& s = slots[pos & mask];
+			intptr_t dif = intptr_t(s.seq.load(std::memory_order_acquire)) - intptr_t(pos + 1);
+			if (dif == 0 && head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				v = s.value;
+				s.seq.store(pos + mask + 1, std::memory_order_release);
+				return true;
+			}
+			if (dif < 0) return false;
+			if (dif > 0) pos = head.load(std::memory_order_relaxed);
+		}
+	}
+
+	/**
+	 * append 'v', yielding while the queue is full; return the number of times it was full
+	 */
+	size_t push(const type& v) {
+		size_t waits = 0;
+		for (; !try_push(v); waits++) std::this_thread::yield();
+		return waits;
+	}
+	/**
+	 * take the first value into 'v', yielding while the queue is empty; return the number of times it was empty
+	 */
+	size_t pop(type& v) {
+		size_t waits = 0;
+		for (; !try_pop(v); waits++) std::this_thread::yield();
+		return waits;
+	}
+
+	size_t capacity() const { return slots.size(); }
+
+private:
+	static size_t round(size_t n) {
+		size_t size = 2;
+		while (size < n) size <<= 1;
+		return size;
+	}
+
+	struct slot {
+		std::atomic<size_t> seq;
+		type value;
+	};
+	std::vector<slot> slots;
+	size_t mask;
+	char pad0[64];
+	std::atomic<size_t> head;
+	char pad1[64];
+	std::atomic<size_t> tail;
+	char pad2[64];
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * counter-based random numbers
+ * the n-th number of a stream is a hash of (key + n * gamma), i.e., the output of SplitMix64,
+ * so that a stream needs no state other than its key and position, and any stream can be created directly,
+ * e.g., the stream of an episode from (seed, episode id), regardless of which thread plays the episode
+ */
+class counter_rng {
+public:
+	counter_rng(uint64_t key = 0, uint64_t n = 0) : key(key), n(n) {}
+
+	/**
+	 * the independent stream (id) of 'seed'
+	 */
+	static counter_rng stream(uint64_t seed, uint64_t id) {
+		return counter_rng(mix(mix(seed) + id * gamma));
+	}
+
+	uint64_t operator()() {
+		return mix(key + (++n) * gamma);
+	}
+	/**
+	 * a uniform integer in [0, bound), by the high bits of a 32-bit draw
+	 */
+	unsigned below(unsigned bound) {
+		return unsigned(((operator()() >> 32) * bound) >> 32);
+	}
+
+	static uint64_t mix(uint64_t z) {
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+private:
+	static constexpr uint64_t gamma = 0x9e3779b97f4a7c15ull;
+	uint64_t key;
+	uint64_t n;
+};
@@ -0,0 +1,438 @@
+#pragma once
+#include <vector>
+#include <limits>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+
+/**
+ * threads that run the tasks of a search together with the calling thread
+ */
+class search_pool {
+public:
+	search_pool(size_t helpers) : job(nullptr), count(0), round(0), busy(0), quit(false) {
+		for (size_t k = 0; k < helpers; k++) threads.emplace_back([this, k]() { serve(k + 1); });
+	}
+	~search_pool() {
+		{
+			std::lock_guard<std::mutex> lock(guard);
+			quit = true;
+		}
+		wake.notify_all();
+		for (std::thread& t : threads) t.join();
+	}
+
+	/**
+	 * run task(i, who) for every (i) in [0, n), where (who) is the thread (0 for the caller), and return once all are done
+	 */
+	void run(size_t n, const std::function<void(size_t, size_t)>& task) {
+		{
+			std::lock_guard<std::mutex> lock(guard);
+			job = &task;
+			count = n;
+			next = 0;
+			busy = threads.size();
+			round++;
+		}
+		wake.notify_all();
+		work(0);
+		std::unique_lock<std::mutex> lock(guard);
+		done.wait(lock, [this]() { return busy == 0; });
+		job = nullptr;
+	}
+	size_t size() const { return threads.size() + 1; }
+
+private:
+	void serve(size_t who) {
+		size_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(guard);
+				wake.wait(lock, [&]() { return quit || round != seen; });
+				if (quit) return;
+				seen = round;
+			}
+			work(who);
+			std::lock_guard<std::mutex> lock(guard);
+			if (--busy == 0) done.notify_one();
+		}
+	}
+	void work(size_t who) {
+		for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count; ) (*job)(i, who);
+	}
+
+	std::vector<std::thread> threads;
+	std::mutex guard;
+	std::condition_variable wake, done;
+	const std::function<void(size_t, size_t)>* job;
+	size_t count;
+	std::atomic<size_t> next;
+	size_t round;
+	size_t busy;
+	bool quit;
+};
+
+/**
+ * the nodes searched by a thread for a move, padded to a cache line
+ */
+struct alignas(64) search_count {
+	size_t nodes = 0, lookups = 0, hits = 0, check = 0;
+};
+
+/**
+ * the statistics of the moves of a player, shared by all its copies (see expectimax_agent)
+ */
+class search_stats {
+public:
+	/**
+	 * write every move to 'path' as CSV from now on, return false if it cannot be opened
+	 */
+	bool trace(const std::string& path) {
+		std::lock_guard<std::mutex> lock(guard);
+		out.open(path, std::ios::out | std::ios::trunc);
+		if (out.is_open()) out << "depth,nodes,ns,nodes_per_sec,tt_lookups,tt_hits" << std::endl;
+		return out.is_open();
+	}
+	void record(int depth, const search_count& c, uint64_t ns) {
+		std::lock_guard<std::mutex> lock(guard);
+		moves++;
+		nodes += c.nodes;
+		lookups += c.lookups;
+		hits += c.hits;
+		elapsed += ns;
+		slowest = std::max(slowest, ns);
+		reached[std::min(depth, 7)]++;
+		if (out.is_open()) {
+			out << depth << "," << c.nodes << "," << ns << "," << uint64_t(c.nodes * 1e9 / std::max<uint64_t>(ns, 1));
+			out << "," << c.lookups << "," << c.hits << std::endl;
+		}
+	}
+	void show(std::ostream& os) {
+		std::lock_guard<std::mutex> lock(guard);
+		if (moves == 0) return;
+		std::ios ff(nullptr);
+		ff.copyfmt(os);
+		os << std::fixed << std::setprecision(1);
+		double depth = 0;
+		for (size_t d = 0; d < 8; d++) depth += double(d) * reached[d];
+		os << "search: " << moves << " moves, depth = " << depth / moves << " (";
+		for (size_t d = 1, first = 1; d < 8; d++) {
+			if (!reached[d]) continue;
+			os << (first ? "" : ", ") << d << ": " << (reached[d] * 100.0 / moves) << "%";
+			first = 0;
+		}
+		os << "), " << (nodes * 1e3 / std::max<uint64_t>(elapsed, 1)) << "M nodes/sec";
+		os << ", tt hit = " << (hits * 100.0 / std::max<size_t>(lookups, 1)) << "%";
+		os << ", time = " << (elapsed / 1e6 / moves) << "ms (max " << (slowest / 1e6) << "ms) per move" << std::endl;
+		os.copyfmt(ff);
+	}
+
+private:
+	std::mutex guard;
+	size_t moves = 0, nodes = 0, lookups = 0, hits = 0;
+	size_t reached[8] = { 0 };
+	uint64_t elapsed = 0, slowest = 0;
+	std::ofstream out;
+};
+
+/**
+ * expectimax player, using the n-tuple network of weight_agent as the leaf evaluator
+ * select it with 'search=expectimax depth=3' (depth 1 is the greedy afterstate player)
+ *
+ * the chance nodes model rndenv exactly: after slide (op), a tile is placed on an empty cell
+ * of the edge opposite to the slide, and the tile is drawn from the remaining bag of {1, 2, 3}
+ * the bag is tracked by comparing each new state with the last afterstate of the player,
+ * and every node carries the state of the environment in its info() (see rndenv::outcomes)
+ *
+ * with 'time_ms=10', every move is searched by iterative deepening from depth 1 until 'depth' (at most 7, the default),
+ * and the move of the deepest finished iteration is played once the time is up; the running iteration is abandoned
+ * at the first of its checks (every 256 nodes) past the deadline, so a move usually ends within about 10 microseconds of it,
+ * but 'time_ms' remains a soft limit: the threads may not run meanwhile, e.g., when preempted, with more workers than cores,
+ * or on page faults of mapped weights, and such a move can take several times the budget (see the max time of the report)
+ * with 'workers=4', the chance outcomes of the root are searched by 4 threads, which share the transposition table
+ * the depth reached, the nodes per second, and the hit rate of the table are reported at the end,
+ * and of every move with 'trace=moves.csv'
+ */
+class expectimax_agent : public weight_agent {
+public:
+	expectimax_agent(const std::string& args = "") : weight_agent(args) { setup(nullptr); }
+	expectimax_agent(const weight_agent& master, const std::string& args) : weight_agent(master, args) { setup(&master); }
+	expectimax_agent(const weight_agent& master, const std::string& args, const std::shared_ptr<const weight>& snapshot)
+		: weight_agent(master, args, snapshot) { setup(&master); }
+	virtual ~expectimax_agent() {
+		if (stats.use_count() == 1) stats->show(std::cout); // the last copy reports for all
+	}
+
+	virtual void open_episode(const std::string& flag = "") {
+		weight_agent::open_episode(flag);
+		bag = rndenv::full_bag;
+		observed = false;
+		generation++; // the weights may have been updated since the last episode
+	}
+
+	virtual action_op take_action2(const board& before) {
+		action_op output;
+		output.op = choose(before);
+		output.s = action::slide(output.op);
+		return output;
+	}
+
+	/**
+	 * the slide chosen for 'before', i.e., the non-virtual entry of take_action2 for the compiled play loop
+	 */
+	int choose(const board& before) {
+		clock::time_point begin = clock::now();
+		deadline = begin + budget;
+		stop.store(false, std::memory_order_relaxed);
+		for (search_count& c : count) c = search_count();
+
+		observe(before);
+		if (online()) generation++; // the weights are updated on every move
+		board after[4];
+		board::reward reward[4];
+		unsigned legal = before.expand(after, reward);
+		for (unsigned rest = legal; rest; rest &= rest - 1) after[__builtin_ctz(rest)].info(rndenv::pack(bag, __builtin_ctz(rest)));
+
+		// without a time budget, only the full depth is searched; depth 1 never stops, so there is always a move
+		int choice = -1, reached = 0;
+		for (int d = timed() ? 1 : depth; d <= depth && legal; d++) {
+			float value[4];
+			if (!root(after, reward, legal, d, value)) break;
+			choice = -1;
+			for (unsigned rest = legal; rest; rest &= rest - 1) {
+				int op = __builtin_ctz(rest);
+				if (choice == -1 || value[op] > value[choice]) choice = op;
+			}
+			reached = d;
+			if (timed() && clock::now() >= deadline) break;
+		}
+		observed = (choice != -1);
+		if (observed) last = after[choice];
+		if (online()) {
+			// the search value is not V(last), so the leaf value is estimated once more
+			if (observed) {
+				features f = extract(last);
+				follow(f, reward[choice], sum(f));
+			} else {
+				follow();
+			}
+		}
+
+		search_count total;
+		for (const search_count& c : count) total.nodes += c.nodes, total.lookups += c.lookups, total.hits += c.hits;
+		if (legal) stats->record(reached, total, std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count());
+		return choice != -1 ? choice : 0;
+	}
+
+protected:
+	typedef std::chrono::steady_clock clock;
+
+	void setup(const weight_agent* master) {
+		budget = std::chrono::milliseconds(meta.find("time_ms") != meta.end() ? std::max(int(meta["time_ms"]), 0) : 0);
+		// the depth is kept in 3 bits of the tags of the transposition table
+		depth = meta.find("depth") != meta.end() ? std::min(std::max(int(meta["depth"]), 1), 7) : (timed() ? 7 : 3);
+		unsigned bits = meta.find("tt") != meta.end() ? unsigned(meta["tt"]) : 20;
+		table.reset(new entry[size_t(1) << bits]);
+		mask = (size_t(1) << bits) - 1;
+		size_t workers = meta.find("workers") != meta.end() ? std::max(int(meta["workers"]), 1) : 1;
+		if (workers > 1) pool.reset(new search_pool(workers - 1));
+		count.assign(workers, search_count());
+		stop.store(false);
+		generation = 0;
+		bag = rndenv::full_bag;
+		observed = false;
+		if (references()) {
+			// the search never plays with the float network, so the divergence would be measured over no position
+			std::cerr << "the reference episodes of quantize are not played by the search, use reference=0" << std::endl;
+			std::exit(1);
+		}
+
+		const expectimax_agent* search = dynamic_cast<const expectimax_agent*>(master);
+		stats = search ? search->stats : std::make_shared<search_stats>();
+		if (!search && meta.find("trace") != meta.end() && !stats->trace(meta["trace"])) {
+			std::cerr << "cannot write the trace to " << std::string(meta["trace"]) << std::endl;
+			std::exit(1);
+		}
+	}
+	bool timed() const { return budget.count() > 0; }
+
+	/**
+	 * remove the tile placed since the last afterstate from the bag
+	 * the bag is refilled once it becomes empty; the first 9 placements always use up 3 full bags
+	 */
+	void observe(const board& before) {
+		if (!observed) return;
+		board::data diff = before.raw() ^ last.raw();
+		if (diff == 0) return;
+		unsigned pos = __builtin_ctzll(diff) >> 2;
+		bag = rndenv::draw(bag, before(pos));
+	}
+
+	/**
+	 * the values of the legal root afterstates with (d) plies in total, i.e., reward + expect(after, d - 1),
+	 * return false if the search is stopped by the deadline
+	 * with workers, the outcomes of all root afterstates are searched in parallel, and are summed in the same order as expect
+	 */
+	bool root(const board (&after)[4], const board::reward (&reward)[4], unsigned legal, int d, float (&value)[4]) {
+		if (!pool || d < 2) {
+			for (unsigned rest = legal; rest; rest &= rest - 1) {
+				int op = __builtin_ctz(rest);
+				value[op] = reward[op] + expect(after[op], d - 1, count[0]);
+			}
+			return !stop.load(std::memory_order_relaxed);
+		}
+
+		rndenv::outcome out[4][rndenv::max_outcomes];
+		size_t n[4] = { 0 }, base[4] = { 0 }, tasks = 0;
+		board next[4 * rndenv::max_outcomes];
+		float result[4 * rndenv::max_outcomes];
+		for (unsigned rest = legal; rest; rest &= rest - 1) {
+			int op = __builtin_ctz(rest);
+			count[0].lookups++;
+			if (lookup(after[op].raw(), tag(after[op], d - 1), value[op])) {
+				count[0].hits++;
+				continue;
+			}
+			n[op] = rndenv::outcomes(after[op], out[op]);
+			base[op] = tasks;
+			for (size_t i = 0; i < n[op]; i++, tasks++) {
+				next[tasks] = after[op];
+				out[op][i].move.apply(next[tasks]);
+				next[tasks].info(out[op][i].state);
+			}
+		}
+		pool->run(tasks, [&](size_t i, size_t who) { result[i] = search(next[i], d - 1, count[who]); });
+		if (stop.load(std::memory_order_relaxed)) return false;
+
+		for (unsigned rest = legal; rest; rest &= rest - 1) {
+			int op = __builtin_ctz(rest);
+			if (n[op]) {
+				float sum = 0;
+				for (size_t i = 0; i < n[op]; i++) sum += out[op][i].probability * result[base[op] + i];
+				store(after[op].raw(), tag(after[op], d - 1), sum);
+				value[op] = sum;
+			}
+			value[op] += reward[op];
+		}
+		return true;
+	}
+
+	/**
+	 * the maximum expected value of a state, where the player has (d) plies to go
+	 */
+	float search(const board& before, int d, search_count& c) {
+		c.nodes++;
+		board after[4];
+		board::reward reward[4];
+		unsigned legal = before.expand(after, reward);
+		unsigned bag = rndenv::bag_of(before.info());
+		float best = 0;
+		for (unsigned rest = legal; rest; rest &= rest - 1) {
+			int op = __builtin_ctz(rest);
+			after[op].info(rndenv::pack(bag, op));
+			float value = reward[op] + expect(after[op], d - 1, c);
+			if (rest == legal || value > best) best = value;
+		}
+		return best; // a terminal state is worth 0
+	}
+
+	/**
+	 * the expected value of an afterstate, over all placements of the environment in its info()
+	 * once the search is stopped, every node returns 0 and nothing is stored
+	 */
+	float expect(const board& after, int d, search_count& c) {
+		c.nodes++;
+		if (d == 0) return evaluate(after);
+		if (timed() && c.nodes >= c.check) {
+			c.check = c.nodes + 256;
+			if (clock::now() >= deadline) stop.store(true, std::memory_order_relaxed);
+		}
+		if (stop.load(std::memory_order_relaxed)) return 0;
+
+		uint32_t key = tag(after, d);
+		float value;
+		c.lookups++;
+		if (lookup(after.raw(), key, value)) {
+			c.hits++;
+			return value;
+		}
+
+		rndenv::outcome out[rndenv::max_outcomes];
+		value = 0;
+		for (size_t i = 0, n = rndenv::outcomes(after, out); i < n; i++) {
+			board next = after;
+			out[i].move.apply(next);
+			next.info(out[i].state);
+			value += out[i].probability * search(next, d, c);
+		}
+		if (!stop.load(std::memory_order_relaxed)) store(after.raw(), key, value);
+		return value;
+	}
+
+	/**
+	 * the tag of an afterstate with (d) plies to go: the generation, the depth, and the state of the environment
+	 */
+	uint32_t tag(const board& after, int d) const {
+		return (generation << 9) | (d << 6) | uint32_t(after.info());
+	}
+	bool lookup(board::data key, uint32_t tag, float& value) const {
+		const entry& slot = table[hash(key, tag)];
+		uint64_t data = slot.data.load(std::memory_order_relaxed), check = slot.check.load(std::memory_order_relaxed);
+		if ((check ^ data) != key || uint32_t(data >> 32) != tag) return false;
+		uint32_t bits = uint32_t(data);
+		std::memcpy(&value, &bits, sizeof(value));
+		return true;
+	}
+	void store(board::data key, uint32_t tag, float value) {
+		entry& slot = table[hash(key, tag)];
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		uint64_t data = (uint64_t(tag) << 32) | bits;
+		slot.data.store(data, std::memory_order_relaxed);
+		slot.check.store(key ^ data, std::memory_order_relaxed);
+	}
+
+	size_t hash(board::data key, uint32_t tag) const {
+		key ^= tag * 0x9e3779b97f4a7c15ull;
+		key ^= key >> 31;
+		key *= 0xbf58476d1ce4e5b9ull;
+		key ^= key >> 29;
+		return key & mask;
+	}
+
+protected:
+	/**
+	 * transposition table entry, keyed by afterstate and tag (see tag), shared by the workers without locking
+	 * the key is stored xor-ed with the data, so that an entry torn by concurrent stores never matches
+	 * (an empty entry matches no tag, since the depth of a tag is at least 1)
+	 */
+	struct entry {
+		std::atomic<uint64_t> check; // key ^ data
+		std::atomic<uint64_t> data; // tag, then the bits of the value
+		entry() : check(0), data(0) {}
+	};
+
+	int depth;
+	std::chrono::milliseconds budget;
+	clock::time_point deadline;
+	std::atomic<bool> stop;
+	std::unique_ptr<entry[]> table;
+	size_t mask;
+	std::unique_ptr<search_pool> pool;
+	std::vector<search_count, aligned_allocator<search_count>> count; // of every worker
+	std::shared_ptr<search_stats> stats;
+	uint32_t generation;
+	unsigned bag;
+	bool observed;
+	board last;
+};
@@ -1,8 +1,15 @@
 #pragma once
-#include <list>
+#include <vector>
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
@@ -16,12 +23,21 @@ public:
 	 * the limit of saving records
 	 *
 	 * note that total >= limit >= block
+	 * a block of size_t(-1) never shows, which is used for the statistic of worker threads
+	 *
+	 * the statistic of a block is accumulated as the episodes are closed, so its memory does not grow with the block,
+	 * and only the last 'limit' episodes are kept (in a ring of reused records), e.g., limit = 1 if no record is exported
 	 */
 	statistic(size_t total, size_t block = 0, size_t limit = 0)
 		: total(total),
 		  block(block ? block : total),
-		  limit(limit ? limit : total),
-		  count(0) {}
+		  limit(limit),
+		  count(0),
+		  target(0),
+		  reached(0),
+		  first(0),
+		  stored(0),
+		  intact(0) {}
 
 public:
 	/**
@@ -47,54 +63,28 @@ public:
 	 *  '22.4%': 22.4% (224 games) terminated with 8192-tiles (the largest)
 	 */
 	void show(bool tstat = true) const {
-		size_t blk = std::min(data.size(), block);
-		size_t stat[64] = { 0 };
-		size_t sop = 0, pop = 0, eop = 0;
-		time_t sdu = 0, pdu = 0, edu = 0;
-		board::reward sum = 0, max = 0;
-		auto it = data.end();
-		for (size_t i = 0; i < blk; i++) {
-			auto& ep = *(--it);
-			sum += ep.score();
-			max = std::max(ep.score(), max);
-			stat[*std::max_element(&(ep.state()(0)), &(ep.state()(16)))]++;
-			sop += ep.step();
-			pop += ep.step(action::slide::type);
-			eop += ep.step(action::place::type);
-			sdu += ep.time();
-			pdu += ep.time(action::slide::type);
-			edu += ep.time(action::place::type);
-		}
+		show(recent, tstat, true);
+	}
 
-		std::ios ff(nullptr);
-		ff.copyfmt(std::cout);
-		std::cout << std::fixed << std::setprecision(0);
-		std::cout << count << "\t";
-		std::cout << "avg = " << (sum / blk) << ", ";
-		std::cout << "max = " << (max) << ", ";
-		std::cout << "ops = " << (sop * 1000.0 / sdu);
-		std::cout <<     " (" << (pop * 1000.0 / pdu);
-		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
-		std::cout << std::endl;
-		std::cout.copyfmt(ff);
+	/**
+	 * show the statistic of all games
+	 */
+	void summary() const {
+		show(overall, true, false);
+	}
 
-		if (!tstat) return;
-		for (size_t t = 0, c = 0; c < blk; c += stat[t++]) {
-			if (stat[t] == 0) continue;
-			unsigned accu = std::accumulate(std::begin(stat) + t, std::end(stat), 0);
-			std::cout << "\t" << ((1 << t) & -2u); // type
-			std::cout << "\t" << (accu * 100.0 / blk) << "%"; // win rate
-			std::cout << "\t" "(" << (stat[t] * 100.0 / blk) << "%" ")"; // percentage of ending
-			std::cout << std::endl;
-		}
-		std::cout << std::endl;
+	/**
+	 * report the first block whose average score reaches 'score', i.e., the games needed to reach it
+	 */
+	void set_target(board::reward score) {
+		target = score;
 	}
 
-	void summary() const {
-		auto block_temp = block;
-		const_cast<statistic&>(*this).block = data.size();
-		show();
-		const_cast<statistic&>(*this).block = block_temp;
+	/**
+	 * the number of episodes played so far
+	 */
+	size_t size() const {
+		return count;
 	}
 
 	bool is_finished() const {
@@ -102,46 +92,254 @@ public:
 	}
 
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
-		data.emplace_back();
-		data.back().open_episode(flag);
+		episode& ep = next();
+		ep.reset();
+		ep.open_episode(flag);
 	}
 
 	void close_episode(const std::string& flag = "") {
-		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		back().close_episode(flag);
+		commit(true);
+	}
+
+	/**
+	 * move a closed episode into this statistic, as if it were opened and closed here
+	 * 'ep' receives a spare record in exchange, e.g., for the next episode of a batch (see interleaved)
+	 */
+	void append(episode& ep) {
+		std::swap(next(), ep);
+		commit(true);
+	}
+
+	/**
+	 * move the episodes recorded by another statistic (e.g., of a worker thread) into this one,
+	 * as if they were opened and closed here
+	 */
+	void merge(statistic& other) {
+		for (size_t i = 0; i < other.stored; i++) {
+			std::swap(next(), other.at(i));
+			commit(true);
+		}
+		other.count = 0;
+		other.first = 0;
+		other.stored = 0;
+		other.recent = other.overall = {};
 	}
 
+	/**
+	 * the kept episodes, from the oldest (0) to the latest (kept() - 1)
+	 */
 	episode& at(size_t i) {
-		auto it = data.begin();
-		while (i--) it++;
-		return *it;
+		return ring[(first + i) % ring.size()];
 	}
 	episode& front() {
-		return data.front();
+		return at(0);
 	}
 	episode& back() {
-		return data.back();
+		return at(stored - 1);
+	}
+	size_t kept() const {
+		return stored;
+	}
+
+	/**
+	 * write the binary record of every episode to 'path' as soon as it is closed or loaded
+	 * with 'append', the records are appended to an existing binary file, e.g., the file just loaded,
+	 * which is first cut at the end of its last intact record
+	 * return false if the file cannot be created, or is not in the binary format
+	 */
+	bool stream(const std::string& path, bool append = false) {
+		if (append) {
+			if (path == source && ::truncate(path.c_str(), intact) != 0) return false;
+			char head[sizeof(magic)] = {};
+			std::ifstream in(path, std::ios::in | std::ios::binary);
+			in.read(head, sizeof(head));
+			if (in.gcount()) {
+				if (std::memcmp(head, magic, sizeof(magic)) != 0) return false;
+				record.open(path, std::ios::out | std::ios::app | std::ios::binary);
+				return record.is_open();
+			}
+		}
+		record.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!record.is_open()) return false;
+		record.write(magic, sizeof(magic));
+		return bool(record);
+	}
+
+	/**
+	 * load the episodes of a file, either in the binary format (mapped and decoded in place) or in the text format
+	 * a missing file has no episodes; return false if a binary record is malformed, keeping the records before it
+	 */
+	bool load(const std::string& path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return true;
+		struct stat st;
+		size_t bytes = ::fstat(fd, &st) == 0 ? size_t(st.st_size) : 0;
+		void* addr = bytes >= sizeof(magic) ? ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (addr == MAP_FAILED || std::memcmp(addr, magic, sizeof(magic)) != 0) {
+			if (addr != MAP_FAILED) ::munmap(addr, bytes);
+			std::ifstream in(path, std::ios::in);
+			in >> *this;
+			return true;
+		}
+		::madvise(addr, bytes, MADV_SEQUENTIAL);
+		const char* begin = static_cast<const char*>(addr);
+		const char* p = begin + sizeof(magic);
+		const char* end = begin + bytes;
+		source = path;
+		while (p != end) {
+			const char* rec = p;
+			if (!(p = next().decode(p, end))) {
+				drop();
+				intact = rec - begin;
+				break;
+			}
+			commit(false);
+		}
+		if (p) intact = bytes;
+		::munmap(addr, bytes);
+		total = std::max(total, count);
+		return p != nullptr;
 	}
 
+	/**
+	 * the text format, one episode per line, kept as an export of the binary records
+	 */
 	friend std::ostream& operator <<(std::ostream& out, const statistic& stat) {
-		for (const episode& rec : stat.data) out << rec << std::endl;
+		for (size_t i = 0; i < stat.stored; i++) out << const_cast<statistic&>(stat).at(i) << std::endl;
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, statistic& stat) {
 		for (std::string line; std::getline(in, line) && line.size(); ) {
-			stat.data.emplace_back();
-			std::stringstream(line) >> stat.data.back();
+			std::stringstream(line) >> stat.next();
+			stat.commit(false);
 		}
-		stat.total = std::max(stat.total, stat.data.size());
-		stat.count = stat.data.size();
+		stat.total = std::max(stat.total, stat.count);
 		return in;
 	}
 
+private:
+	/**
+	 * running sums of a set of episodes
+	 */
+	struct totals {
+		size_t games = 0;
+		size_t tiles[16] = { 0 }; // the number of games ended with each largest tile
+		size_t sop = 0, pop = 0, eop = 0;
+		time_t sdu = 0, pdu = 0, edu = 0;
+		int64_t sum = 0;
+		board::reward max = 0;
+
+		void add(const episode& ep) {
+			games++;
+			sum += ep.score();
+			max = std::max(ep.score(), max);
+			tiles[ep.state().max_tile()]++;
+			sop += ep.step();
+			pop += ep.step(action::slide::type);
+			eop += ep.step(action::place::type);
+			sdu += ep.time();
+			pdu += ep.time(action::slide::type);
+			edu += ep.time(action::place::type);
+		}
+	};
+
+	/**
+	 * with 'profile', the phases profiled since the last block are also shown (if compiled with PROFILE)
+	 */
+	void show(const totals& t, bool tstat, bool profile) const {
+		size_t blk = t.games;
+		int64_t avg = blk ? t.sum / int64_t(blk) : 0;
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::fixed << std::setprecision(0);
+		std::cout << count << "\t";
+		std::cout << "avg = " << (avg) << ", ";
+		std::cout << "max = " << (t.max) << ", ";
+		std::cout << "ops = " << (t.sop * 1000.0 / t.sdu);
+		std::cout <<     " (" << (t.pop * 1000.0 / t.pdu);
+		std::cout <<      "|" << (t.eop * 1000.0 / t.edu) << ")";
+		std::cout << std::endl;
+		if (target && !reached && blk && avg >= target) {
+			const_cast<statistic&>(*this).reached = count;
+			std::cout << "\t" "target " << target << " reached after " << count << " games" << std::endl;
+		}
+		std::cout.copyfmt(ff);
+		if (profile) PROFILE_SHOW();
+
+		if (!tstat) return;
+		for (size_t i = 0, c = 0; c < blk; c += t.tiles[i++]) {
+			if (t.tiles[i] == 0) continue;
+			size_t accu = std::accumulate(std::begin(t.tiles) + i, std::end(t.tiles), size_t(0));
+			std::cout << "\t" << ((1 << i) & -2u); // type
+			std::cout << "\t" << (accu * 100.0 / blk) << "%"; // win rate
+			std::cout << "\t" "(" << (t.tiles[i] * 100.0 / blk) << "%" ")"; // percentage of ending
+			std::cout << std::endl;
+		}
+		std::cout << std::endl;
+	}
+
+	/**
+	 * the record for a new episode, which replaces the oldest one once 'limit' episodes are kept
+	 */
+	episode& next() {
+		count++;
+		if (stored < (limit ? limit : std::max(total, count))) { // 'limit' is 'total' by default, including the loaded episodes
+			if (stored == ring.size()) ring.emplace_back();
+			stored++;
+		} else {
+			first = (first + 1) % ring.size();
+		}
+		return back();
+	}
+	/**
+	 * discard the record just taken by next()
+	 */
+	void drop() {
+		count--;
+		stored--;
+	}
+	/**
+	 * account for the latest record, and show the block it completes
+	 */
+	void commit(bool display) {
+		PROFILE_SCOPE(record);
+		episode& ep = back();
+		recent.add(ep);
+		overall.add(ep);
+		write(ep);
+		if (ring.size() > 1) ep.shrink(); // a kept record holds only its own moves
+		if (block && count % block == 0) {
+			if (display) show();
+			recent = {};
+		}
+	}
+
+	void write(const episode& rec) {
+		if (!record.is_open()) return;
+		buffer.clear();
+		rec.encode(buffer);
+		record.write(buffer.data(), buffer.size());
+	}
+
 private:
 	size_t total;
 	size_t block;
-	size_t limit;
+	size_t limit; // 0 for 'total'
 	size_t count;
-	std::list<episode> data;
+	board::reward target;
+	size_t reached;
+	totals recent; // the current block
+	totals overall;
+	std::vector<episode> ring;
+	size_t first; // the index of the oldest record in 'ring'
+	size_t stored;
+	std::ofstream record;
+	std::string buffer;
+	std::string source; // the binary file loaded
+	size_t intact; // the bytes of 'source' before a malformed record
+
+	static constexpr char magic[8] = { 'T', 'H', 'R', 'E', 'E', 'S', 'R', 1 };
 };
+constexpr char statistic::magic[8];
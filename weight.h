@@ -11,36 +11,112 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+/**
+ * allocator of cache-line aligned storage, so that each group of 16 floats is exactly one cache line
+ */
+template<typename type, size_t align = 64>
+struct aligned_allocator {
+	typedef type value_type;
+	template<typename rebound> struct rebind { typedef aligned_allocator<rebound, align> other; };
+	aligned_allocator() {}
+	template<typename rebound> aligned_allocator(const aligned_allocator<rebound, align>&) {}
+
+	type* allocate(size_t n) {
+		void* p = nullptr;
+		if (posix_memalign(&p, align, n * sizeof(type)) != 0) throw std::bad_alloc();
+		return static_cast<type*>(p);
+	}
+	void deallocate(type* p, size_t) { std::free(p); }
+
+	template<typename rebound> bool operator ==(const aligned_allocator<rebound, align>&) const { return true; }
+	template<typename rebound> bool operator !=(const aligned_allocator<rebound, align>&) const { return false; }
+};
+
+/**
+ * an array of float weights, either owned or mapped from a file without copying
+ */
 class weight {
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	weight() : ptr(nullptr), len(0) {}
+	weight(size_t len) : value(len), ptr(value.data()), len(len) {}
+	weight(weight&& f) : value(std::move(f.value)), mapping(std::move(f.mapping)), ptr(f.ptr), len(f.len) { f.ptr = nullptr; f.len = 0; }
+	weight(const weight& f) : value(f.ptr, f.ptr + f.len), ptr(value.data()), len(f.len) {}
+
+	weight& operator =(weight f) {
+		std::swap(value, f.value);
+		std::swap(mapping, f.mapping);
+		std::swap(ptr, f.ptr);
+		std::swap(len, f.len);
+		return *this;
+	}
+	float& operator[] (size_t i) { return ptr[i]; }
+	const float& operator[] (size_t i) const { return ptr[i]; }
+	size_t size() const { return len; }
+	float* data() { return ptr; }
+	const float* data() const { return ptr; }
+	bool mapped() const { return mapping != nullptr; }
 
-	weight& operator =(const weight& f) = default;
-	float& operator[] (size_t i) { return value[i]; }
-	const float& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	/**
+	 * a weight of 'len' floats at byte 'offset' of a file, mapped without copying
+	 * a read-only mapping is shared by all processes mapping the same file,
+	 * while a writable one is copy-on-write, so that updates never reach the file
+	 * return an empty weight if the file cannot be mapped
+	 */
+	static weight map(const std::string& path, size_t offset, size_t len, bool writable) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return {};
+		struct stat st;
+		size_t bytes = offset + len * sizeof(float);
+		void* addr = MAP_FAILED;
+		if (::fstat(fd, &st) == 0 && size_t(st.st_size) >= bytes)
+			addr = ::mmap(nullptr, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, writable ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+		::close(fd);
+		if (addr == MAP_FAILED) return {};
+
+		weight w;
+		w.mapping = std::shared_ptr<void>(addr, [bytes](void* p) { ::munmap(p, bytes); });
+		w.ptr = reinterpret_cast<float*>(static_cast<char*>(addr) + offset);
+		w.len = len;
+		return w;
+	}
+	/**
+	 * a view of the floats of 'w' without copying, which keeps 'w' alive; the view must never be written
+	 */
+	static weight share(const std::shared_ptr<const weight>& w) {
+		weight v;
+		v.mapping = std::const_pointer_cast<weight>(w);
+		v.ptr = w->ptr;
+		v.len = w->len;
+		return v;
+	}
 
 public:
 	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+		uint64_t size = w.size();
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(float) * size);
+		out.write(reinterpret_cast<const char*>(w.data()), sizeof(float) * size);
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(float) * size);
+		w = weight(size);
+		in.read(reinterpret_cast<char*>(w.data()), sizeof(float) * size);
 		return in;
 	}
 
 protected:
-	std::vector<float> value;
+	std::vector<float, aligned_allocator<float>> value;
+	std::shared_ptr<void> mapping;
+	float* ptr;
+	size_t len;
 };